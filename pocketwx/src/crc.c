@@ -0,0 +1,208 @@
+/*
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2, or (at your option)
+ * any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; see the file COPYING.  If not, write to
+ * the Free Software Foundation, Inc., 51 Franklin Street,
+ * Boston, MA 02110-1301, USA.
+ */
+
+#include "crc.h"
+
+/*
+ * One entry per value of the top byte, so each data byte costs a lookup
+ * instead of eight shift and test passes.  Being const, sdcc keeps this in
+ * code space.  The ISS sends the CRC of its first six bytes in bytes six and
+ * seven, so the CRC over all eight comes out zero for a good packet.
+ */
+const u16 crc16_table[256] = {
+    0x0000, 0x1021, 0x2042, 0x3063, 0x4084, 0x50a5, 0x60c6, 0x70e7,
+    0x8108, 0x9129, 0xa14a, 0xb16b, 0xc18c, 0xd1ad, 0xe1ce, 0xf1ef,
+    0x1231, 0x0210, 0x3273, 0x2252, 0x52b5, 0x4294, 0x72f7, 0x62d6,
+    0x9339, 0x8318, 0xb37b, 0xa35a, 0xd3bd, 0xc39c, 0xf3ff, 0xe3de,
+    0x2462, 0x3443, 0x0420, 0x1401, 0x64e6, 0x74c7, 0x44a4, 0x5485,
+    0xa56a, 0xb54b, 0x8528, 0x9509, 0xe5ee, 0xf5cf, 0xc5ac, 0xd58d,
+    0x3653, 0x2672, 0x1611, 0x0630, 0x76d7, 0x66f6, 0x5695, 0x46b4,
+    0xb75b, 0xa77a, 0x9719, 0x8738, 0xf7df, 0xe7fe, 0xd79d, 0xc7bc,
+    0x48c4, 0x58e5, 0x6886, 0x78a7, 0x0840, 0x1861, 0x2802, 0x3823,
+    0xc9cc, 0xd9ed, 0xe98e, 0xf9af, 0x8948, 0x9969, 0xa90a, 0xb92b,
+    0x5af5, 0x4ad4, 0x7ab7, 0x6a96, 0x1a71, 0x0a50, 0x3a33, 0x2a12,
+    0xdbfd, 0xcbdc, 0xfbbf, 0xeb9e, 0x9b79, 0x8b58, 0xbb3b, 0xab1a,
+    0x6ca6, 0x7c87, 0x4ce4, 0x5cc5, 0x2c22, 0x3c03, 0x0c60, 0x1c41,
+    0xedae, 0xfd8f, 0xcdec, 0xddcd, 0xad2a, 0xbd0b, 0x8d68, 0x9d49,
+    0x7e97, 0x6eb6, 0x5ed5, 0x4ef4, 0x3e13, 0x2e32, 0x1e51, 0x0e70,
+    0xff9f, 0xefbe, 0xdfdd, 0xcffc, 0xbf1b, 0xaf3a, 0x9f59, 0x8f78,
+    0x9188, 0x81a9, 0xb1ca, 0xa1eb, 0xd10c, 0xc12d, 0xf14e, 0xe16f,
+    0x1080, 0x00a1, 0x30c2, 0x20e3, 0x5004, 0x4025, 0x7046, 0x6067,
+    0x83b9, 0x9398, 0xa3fb, 0xb3da, 0xc33d, 0xd31c, 0xe37f, 0xf35e,
+    0x02b1, 0x1290, 0x22f3, 0x32d2, 0x4235, 0x5214, 0x6277, 0x7256,
+    0xb5ea, 0xa5cb, 0x95a8, 0x8589, 0xf56e, 0xe54f, 0xd52c, 0xc50d,
+    0x34e2, 0x24c3, 0x14a0, 0x0481, 0x7466, 0x6447, 0x5424, 0x4405,
+    0xa7db, 0xb7fa, 0x8799, 0x97b8, 0xe75f, 0xf77e, 0xc71d, 0xd73c,
+    0x26d3, 0x36f2, 0x0691, 0x16b0, 0x6657, 0x7676, 0x4615, 0x5634,
+    0xd94c, 0xc96d, 0xf90e, 0xe92f, 0x99c8, 0x89e9, 0xb98a, 0xa9ab,
+    0x5844, 0x4865, 0x7806, 0x6827, 0x18c0, 0x08e1, 0x3882, 0x28a3,
+    0xcb7d, 0xdb5c, 0xeb3f, 0xfb1e, 0x8bf9, 0x9bd8, 0xabbb, 0xbb9a,
+    0x4a75, 0x5a54, 0x6a37, 0x7a16, 0x0af1, 0x1ad0, 0x2ab3, 0x3a92,
+    0xfd2e, 0xed0f, 0xdd6c, 0xcd4d, 0xbdaa, 0xad8b, 0x9de8, 0x8dc9,
+    0x7c26, 0x6c07, 0x5c64, 0x4c45, 0x3ca2, 0x2c83, 0x1ce0, 0x0cc1,
+    0xef1f, 0xff3e, 0xcf5d, 0xdf7c, 0xaf9b, 0xbfba, 0x8fd9, 0x9ff8,
+    0x6e17, 0x7e36, 0x4e55, 0x5e74, 0x2e93, 0x3eb2, 0x0ed1, 0x1ef0
+};
+
+u16 crc16_ccitt(const __xdata u8 *buf, u8 len)
+{
+    u16 crc = 0;
+
+    while (len--)
+        CRC16_UPDATE(crc, *buf++);
+    return crc;
+}
+
+/*
+ * Error syndromes.  The CRC is linear and starts from zero, so the CRC of a
+ * damaged packet is the XOR of the CRCs of each flipped bit on its own.  Bit
+ * k is bit 7 - (k & 7) of byte k >> 3, the order the CRC takes them in.
+ */
+
+/* CRC of an eight byte packet with only bit k set, by k */
+static const u16 crc16_bit_syndrome[64] = {
+    0xfd81, 0xf6d0, 0x7b68, 0x3db4, 0x1eda, 0x0f6d, 0x8fa6, 0x47d3,
+    0xabf9, 0xddec, 0x6ef6, 0x377b, 0x93ad, 0xc1c6, 0x60e3, 0xb861,
+    0xd420, 0x6a10, 0x3508, 0x1a84, 0x0d42, 0x06a1, 0x8b40, 0x45a0,
+    0x22d0, 0x1168, 0x08b4, 0x045a, 0x022d, 0x8906, 0x4483, 0xaa51,
+    0xdd38, 0x6e9c, 0x374e, 0x1ba7, 0x85c3, 0xcaf1, 0xed68, 0x76b4,
+    0x3b5a, 0x1dad, 0x86c6, 0x4363, 0xa9a1, 0xdcc0, 0x6e60, 0x3730,
+    0x1b98, 0x0dcc, 0x06e6, 0x0373, 0x89a9, 0xccc4, 0x6662, 0x3331,
+    0x9188, 0x48c4, 0x2462, 0x1231, 0x8108, 0x4084, 0x2042, 0x1021
+};
+
+/* The same syndromes sorted for searching, and the bit each one belongs to */
+static const u16 crc16_single_syndrome[64] = {
+    0x022d, 0x0373, 0x045a, 0x06a1, 0x06e6, 0x08b4, 0x0d42, 0x0dcc,
+    0x0f6d, 0x1021, 0x1168, 0x1231, 0x1a84, 0x1b98, 0x1ba7, 0x1dad,
+    0x1eda, 0x2042, 0x22d0, 0x2462, 0x3331, 0x3508, 0x3730, 0x374e,
+    0x377b, 0x3b5a, 0x3db4, 0x4084, 0x4363, 0x4483, 0x45a0, 0x47d3,
+    0x48c4, 0x60e3, 0x6662, 0x6a10, 0x6e60, 0x6e9c, 0x6ef6, 0x76b4,
+    0x7b68, 0x8108, 0x85c3, 0x86c6, 0x8906, 0x89a9, 0x8b40, 0x8fa6,
+    0x9188, 0x93ad, 0xa9a1, 0xaa51, 0xabf9, 0xb861, 0xc1c6, 0xcaf1,
+    0xccc4, 0xd420, 0xdcc0, 0xdd38, 0xddec, 0xed68, 0xf6d0, 0xfd81
+};
+
+static const u8 crc16_single_bit[64] = {
+    28, 51, 27, 21, 50, 26, 20, 49,  5, 63, 25, 59, 19, 48, 35, 41,
+     4, 62, 24, 58, 55, 18, 47, 34, 11, 40,  3, 61, 43, 30, 23,  7,
+    57, 14, 54, 17, 46, 33, 10, 39,  2, 60, 36, 42, 29, 52, 22,  6,
+    56, 12, 44, 31,  8, 15, 13, 37, 53, 16, 45, 32,  9, 38,  1,  0
+};
+
+/*
+ * Syndromes shared by more than one pattern of two flipped bits.  Over 64
+ * bits CRC-16/CCITT has a Hamming distance of 4, so these 252 of the 1764
+ * possible double bit syndromes can't be pinned to one pair.  Sorted.
+ */
+static const u16 crc16_ambiguous[252] = {
+    0x0123, 0x0246, 0x0273, 0x048c, 0x04cb, 0x04e6, 0x0635, 0x0729,
+    0x0918, 0x0996, 0x09cc, 0x0acf, 0x0b37, 0x0c6a, 0x0cc5, 0x0e15,
+    0x0e52, 0x0e83, 0x0f6f, 0x1230, 0x132c, 0x1352, 0x1398, 0x159e,
+    0x166b, 0x166e, 0x17c9, 0x18d4, 0x198a, 0x19f7, 0x1c2a, 0x1ca4,
+    0x1d06, 0x1ede, 0x1ffd, 0x20b9, 0x20fd, 0x22e1, 0x2460, 0x2501,
+    0x2613, 0x2658, 0x26a4, 0x2711, 0x2730, 0x28a9, 0x29a1, 0x2ae3,
+    0x2b3c, 0x2c97, 0x2cd6, 0x2cdc, 0x2d95, 0x2dff, 0x2f92, 0x3167,
+    0x31a8, 0x3314, 0x3321, 0x33ee, 0x3443, 0x35d7, 0x3829, 0x3854,
+    0x3948, 0x3977, 0x3a0c, 0x3dbc, 0x3ffa, 0x41fa, 0x43f7, 0x4585,
+    0x45c2, 0x4739, 0x478d, 0x48c0, 0x4a02, 0x4c26, 0x4c37, 0x4cb0,
+    0x4d48, 0x4e22, 0x4e60, 0x5152, 0x5342, 0x5569, 0x55c6, 0x55eb,
+    0x5678, 0x58fb, 0x592e, 0x59ac, 0x59b8, 0x59e7, 0x5b2a, 0x5bfe,
+    0x5d29, 0x5d57, 0x5e07, 0x5f24, 0x62ce, 0x6350, 0x64c1, 0x657d,
+    0x6628, 0x6642, 0x6695, 0x67dc, 0x683d, 0x6857, 0x6886, 0x6bae,
+    0x6cb1, 0x6d13, 0x7052, 0x70a8, 0x718b, 0x7290, 0x72db, 0x72ee,
+    0x73cd, 0x7418, 0x7453, 0x7499, 0x75c7, 0x7691, 0x76c1, 0x77bd,
+    0x7a67, 0x7b78, 0x7c89, 0x7ed7, 0x7fd9, 0x7ff4, 0x8325, 0x83f4,
+    0x84eb, 0x87ee, 0x8881, 0x8929, 0x8a75, 0x8b0a, 0x8b84, 0x8d77,
+    0x8d8b, 0x8e72, 0x8f1a, 0x8f51, 0x8fa7, 0x90a3, 0x9180, 0x92fb,
+    0x9404, 0x94ab, 0x984c, 0x986e, 0x9960, 0x9a90, 0x9b19, 0x9c44,
+    0x9cc0, 0x9d61, 0x9e5b, 0x9eef, 0xa2a4, 0xa2e5, 0xa46d, 0xa4e3,
+    0xa684, 0xa6bb, 0xa713, 0xa9eb, 0xaad2, 0xab8c, 0xabd6, 0xae0b,
+    0xb0d5, 0xb17d, 0xb1f6, 0xb239, 0xb25c, 0xb2f3, 0xb358, 0xb370,
+    0xb3ce, 0xb523, 0xb654, 0xb7fc, 0xba52, 0xba70, 0xbaae, 0xbc0e,
+    0xbc3b, 0xbe48, 0xbe99, 0xc041, 0xc16d, 0xc245, 0xc59c, 0xc6a0,
+    0xc6db, 0xc73d, 0xc767, 0xc982, 0xca65, 0xcafa, 0xcc50, 0xcc84,
+    0xcd2a, 0xceab, 0xced5, 0xcfb8, 0xcfc3, 0xd07a, 0xd0ae, 0xd10c,
+    0xd169, 0xd281, 0xd60d, 0xd75c, 0xd962, 0xda26, 0xda61, 0xdb4d,
+    0xdb99, 0xdce5, 0xdf15, 0xe0a4, 0xe150, 0xe316, 0xe35b, 0xe520,
+    0xe5b6, 0xe5dc, 0xe79a, 0xe830, 0xe8a6, 0xe932, 0xeb7d, 0xeb8e,
+    0xeba3, 0xed22, 0xef45, 0xef7a, 0xeff1, 0xf4ce, 0xf6f0, 0xf9bd,
+    0xfdae, 0xfdc1, 0xffb2, 0xffe8
+};
+
+#define NOT_FOUND   0xFF
+#define AMBIGUOUS_COUNT (sizeof(crc16_ambiguous) / sizeof(crc16_ambiguous[0]))
+
+#define FLIP_BIT(buf, k)    ((buf)[(k) >> 3] ^= 0x80 >> ((k) & 7))
+
+/* Binary search of a sorted table.  Index of s in it, or NOT_FOUND. */
+static u8 find_syndrome(const u16 *table, u8 n, u16 s)
+{
+    u8 lo = 0;
+    u8 hi = n;
+
+    while (lo < hi) {
+        u8 mid = lo + ((hi - lo) >> 1);
+        u16 v = table[mid];
+
+        if (v == s)
+            return mid;
+        if (v < s)
+            lo = mid + 1;
+        else
+            hi = mid;
+    }
+    return NOT_FOUND;
+}
+
+/*
+ * Try to repair an eight byte packet whose CRC came out as syndrome instead
+ * of zero.  Returns the number of bits flipped, 1 or 2, or 0 if the damage
+ * is beyond what can be pinned down and the packet is left alone.  Noise
+ * will sometimes "repair" into a good CRC, so only use this when a packet
+ * is expected.  Worst case is 64 searches of the single bit table, so this
+ * is for the main loop, not interrupt context.
+ */
+u8 crc16_repair(__xdata u8 *buf, u16 syndrome)
+{
+    u8 i;
+    u8 j;
+
+    if (syndrome == 0)
+        return 0;
+
+    j = find_syndrome(crc16_single_syndrome, 64, syndrome);
+    if (j != NOT_FOUND) {
+        FLIP_BIT(buf, crc16_single_bit[j]);
+        return 1;
+    }
+
+    if (find_syndrome(crc16_ambiguous, AMBIGUOUS_COUNT, syndrome) != NOT_FOUND)
+        return 0;
+
+    /* Each pair turns up twice.  Take it the first time round. */
+    for (i = 0; i < 64; i++) {
+        j = find_syndrome(crc16_single_syndrome, 64,
+                          syndrome ^ crc16_bit_syndrome[i]);
+        if (j != NOT_FOUND && crc16_single_bit[j] > i) {
+            FLIP_BIT(buf, i);
+            FLIP_BIT(buf, crc16_single_bit[j]);
+            return 2;
+        }
+    }
+    return 0;
+}
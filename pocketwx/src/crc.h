@@ -0,0 +1,33 @@
+/*
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2, or (at your option)
+ * any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; see the file COPYING.  If not, write to
+ * the Free Software Foundation, Inc., 51 Franklin Street,
+ * Boston, MA 02110-1301, USA.
+ */
+
+#ifndef CRC_H
+#define CRC_H 1
+
+#include "types.h"
+
+/* CRC-16/CCITT as used by the ISS: polynomial 0x1021, starting from zero */
+extern const u16 crc16_table[256];
+
+/* Fold one more byte into a running CRC */
+#define CRC16_UPDATE(crc, b) \
+    ((crc) = ((crc) << 8) ^ crc16_table[(u8)((crc) >> 8) ^ (u8)(b)])
+
+u16 crc16_ccitt(const __xdata u8 *buf, u8 len);
+u8 crc16_repair(__xdata u8 *buf, u16 syndrome);
+
+#endif
@@ -28,6 +28,7 @@
 #include "bits.h"
 #include "types.h"
 #include "5x7.h"
+#include "dma.h"
 
 void sleepMillis(int ms) {
 	int j;
@@ -57,32 +58,149 @@ void setIOPorts() {
 #define SPI_BAUD_M  170
 #define SPI_BAUD_E  16
 
+/*
+ * LCD transfer queue.  txCtl() and txData() only queue their byte, in runs
+ * that share one setting of A0, and lcd_flush() hands the queue to a DMA
+ * channel triggered by USART0 TX.  lcd_dma_isr() switches A0 between runs and
+ * lets go of SSN after the last, so the CPU gets back to the radio while a
+ * screenful goes out.  The pool belongs to the DMA until lcd_busy() goes
+ * false, so queueing more before then waits.
+ */
+#define LCD_POOL 64
+#define LCD_RUNS 16
+
+/* U0DBUF as seen by the DMA */
+#define X_U0DBUF 0xDFC1
+
+typedef struct {
+	u8 a0;
+	u16 src;
+	u16 len;
+} lcd_run;
+
+static __xdata u8 lcd_pool[LCD_POOL];
+static __xdata lcd_run lcd_runs[LCD_RUNS];
+static u8 lcd_used;
+static u8 lcd_nruns;
+static volatile u8 lcd_next;
+static volatile bool lcd_active;
+
 void configureSPI() {
 	U0CSR = 0;  //Set SPI Master operation
 	U0BAUD =  SPI_BAUD_M; // set Mantissa
 	U0GCR = U0GCR_ORDER | SPI_BAUD_E; // set clock on 1st edge, -ve clock polarity, MSB first, and exponent
+
+	/* Anything queued before a reset is gone */
+	lcd_used = 0;
+	lcd_nruns = 0;
+	lcd_active = false;
+}
+
+/*
+ * Only ever called with the channel idle, from lcd_flush() or from the end
+ * of the run before, so the ISR and main loop never share its statics.
+ */
+static void lcd_start(u8 i) {
+	static __xdata dma_desc *d;
+	static __xdata lcd_run *r;
+
+	d = dma_channel(DMA_CH_LCD);
+	r = &lcd_runs[i];
+	A0 = r->a0;
+	DMA_SET_SRC(d, r->src);
+	DMA_SET_DST(d, X_U0DBUF);
+	DMA_SET_LEN(d, r->len);
+	d->cfg0 = DMA_WORDSIZE_BYTE | DMA_TMODE_SINGLE | DMA_TRIG_UTX0;
+	d->cfg1 = DMA_SRCINC_1 | DMA_DESTINC_0 | DMA_IRQMASK |
+	          DMA_M8_USE_8_BITS | DMA_PRI_LOW;
+	lcd_next = i + 1;
+	dma_arm(DMA_CH_LCD);
+	/* The first byte by hand, then each one sent triggers the next */
+	DMAREQ = DMA_ARM_BIT(DMA_CH_LCD);
 }
-void tx(unsigned char ch) {
-	U0DBUF = ch;
-	while(!(U0CSR & U0CSR_TX_BYTE)); // wait for byte to be transmitted
-	U0CSR &= ~U0CSR_TX_BYTE;         // Clear transmit byte status
+
+/* Called from dma_isr when a run has gone into the USART */
+void lcd_dma_isr(void) {
+	/* A0 has to hold until the last byte is out on the wire */
+	while (U0CSR & U0CSR_ACTIVE);
+	if (lcd_next < lcd_nruns) {
+		lcd_start(lcd_next);
+		return;
+	}
+	SSN = HIGH;
+	lcd_used = 0;
+	lcd_nruns = 0;
+	lcd_active = false;
+}
+
+bool lcd_busy(void) {
+	return lcd_active;
+}
+
+void lcd_wait(void) {
+	while (lcd_active);
+}
+
+/* Start sending whatever is queued.  Returns without waiting for it. */
+void lcd_flush(void) {
+	if (lcd_active || lcd_nruns == 0)
+		return;
+	lcd_active = true;
+	SSN = LOW;
+	lcd_start(0);
+}
+
+static void lcd_queue(u8 a0, u8 ch) {
+	__xdata lcd_run *r;
+
+	lcd_wait();
+	r = &lcd_runs[lcd_nruns ? lcd_nruns - 1 : 0];
+	if (lcd_nruns == 0 || r->a0 != a0 ||
+	    r->src + r->len != (u16)&lcd_pool[lcd_used]) {
+		if (lcd_nruns == LCD_RUNS) {
+			lcd_flush();
+			lcd_wait();
+		}
+		r = &lcd_runs[lcd_nruns++];
+		r->a0 = a0;
+		r->src = (u16)&lcd_pool[lcd_used];
+		r->len = 0;
+	}
+	lcd_pool[lcd_used++] = ch;
+	r->len++;
+	if (lcd_used == LCD_POOL) {
+		lcd_flush();
+		lcd_wait();
+	}
+}
+
+/* Queue len bytes straight from buf, which has to stay put until sent */
+static void lcd_send(u8 a0, __xdata u8 *buf, u16 len) {
+	__xdata lcd_run *r;
+
+	lcd_wait();
+	if (lcd_nruns == LCD_RUNS) {
+		lcd_flush();
+		lcd_wait();
+	}
+	r = &lcd_runs[lcd_nruns++];
+	r->a0 = a0;
+	r->src = (u16)buf;
+	r->len = len;
 }
 
 void txData(unsigned char ch) {
-	A0 = HIGH;
-	tx(ch);
+	lcd_queue(HIGH, ch);
 }
 
 void txCtl(unsigned char ch){
-	A0 = LOW;
-	tx(ch);
+	lcd_queue(LOW, ch);
 }
 
 void LCDReset(void) {
 	LCDRst = LOW; // hold down the RESET line to reset the display
 	sleepMillis(1);
 	LCDRst = HIGH;
-	SSN = LOW;
 	/* initialization sequence from sniffing factory firmware */
 	txCtl(RESET);
 	txCtl(SET_REG_RESISTOR);
@@ -94,7 +212,8 @@ void LCDReset(void) {
 	txCtl(ADC_REVERSE);
 	txCtl(DISPLAY_ON);
 	txCtl(ALL_POINTS_NORMAL);
-	SSN = HIGH;
+	lcd_flush();
+	lcd_wait();
 }
 
 /* initiate sleep mode */
@@ -102,6 +221,9 @@ void LCDPowerSave() {
 	txCtl(STATIC_INDIC_OFF);
 	txCtl(DISPLAY_OFF);
 	txCtl(ALL_POINTS_ON); // Display all Points on cmd = Power Save when following LCD off
+	/* The USART stops in PM3, so this has to be out first */
+	lcd_flush();
+	lcd_wait();
 }
 
 void setCursor(unsigned char row, unsigned char col) {
@@ -118,35 +240,169 @@ void setNormalReverse(unsigned char normal) {  // 0 = Normal, 1 = Reverse
 	txCtl(DISPLAY_NORMAL | (normal & 0x01) );
 }
 
+/*
+ * Shadow of the LCD memory.  Everything draws here, and each column byte that
+ * actually changes gets its bit set in fb_dirty.  display_render() then sends
+ * only those spans, by DMA straight out of fb, so redrawing what is already
+ * on the glass costs nothing.  Byte x of page p holds pixels (x, 8p) to
+ * (x, 8p + 7), least significant bit at the top, as the controller has them.
+ * There is no room for a second copy to diff against, so the diff is done
+ * as the bytes are written.
+ */
+static __xdata u8 fb[FB_PAGES][WIDTH];
+static __xdata u8 fb_dirty[FB_PAGES][FB_DIRTY_BYTES];
+static u8 textPage;
+static u8 textX;
+
+/* Resending this many clean columns is cheaper than another setCursor() */
+#define FB_GAP 3
+
+static void fb_put(u8 page, u8 x, u8 b) {
+	if (fb[page][x] == b)
+		return;
+	fb[page][x] = b;
+	fb_dirty[page][x >> 3] |= 1 << (x & 7);
+}
+
+static bool fb_is_dirty(u8 page, u8 x) {
+	return fb_dirty[page][x >> 3] & (1 << (x & 7));
+}
+
 /* clear all LCD pixels */
 void clear() {
-	u8 row;
-	u8 col;
+	u8 page;
+	u8 i;
+
+	for (page = 0; page < FB_PAGES; page++) {
+		for (i = 0; i < WIDTH; i++)
+			fb[page][i] = 0;
+		for (i = 0; i < FB_DIRTY_BYTES; i++)
+			fb_dirty[page][i] = 0;
+	}
 
-	SSN = LOW;
 	setDisplayStart(0);
 
 	/* normal display mode (not inverted) */
 	setNormalReverse(0);
 
-	for (row = 0; row <= 9; row++) {
-		setCursor(row, 0);
-	for (col = 0; col < WIDTH; col++)
-		txData(0x00);
+	/* Past the framebuffer too, for the icon row, using a blank page */
+	for (page = 0; page <= 9; page++) {
+		setCursor(page, 0);
+		lcd_send(HIGH, fb[page < FB_PAGES ? page : 0], WIDTH);
 	}
+	lcd_flush();
+	/* Nothing can draw in fb until the blank pages are out */
+	lcd_wait();
+}
 
-	SSN = HIGH;
+void fb_pixel(u8 x, u8 y, bool on) {
+	u8 page;
+	u8 mask;
+
+	if (x >= WIDTH || y >= FB_HEIGHT)
+		return;
+	page = y >> 3;
+	mask = 1 << (y & 7);
+	fb_put(page, x, on ? fb[page][x] | mask : fb[page][x] & ~mask);
+}
+
+/* Bresenham, both ends included */
+void fb_line(u8 x0, u8 y0, u8 x1, u8 y1, bool on) {
+	s16 dx = x1 > x0 ? x1 - x0 : x0 - x1;
+	s16 dy = y1 > y0 ? y0 - y1 : y1 - y0;
+	s8 sx = x0 < x1 ? 1 : -1;
+	s8 sy = y0 < y1 ? 1 : -1;
+	s16 err = dx + dy;
+	s16 e2;
+
+	while (1) {
+		fb_pixel(x0, y0, on);
+		if (x0 == x1 && y0 == y1)
+			break;
+		e2 = 2 * err;
+		if (e2 >= dy) {
+			err += dy;
+			x0 += sx;
+		}
+		if (e2 <= dx) {
+			err += dx;
+			y0 += sy;
+		}
+	}
 }
 
-/* sdcc provides printf if we provide this */
+/*
+ * Copy in a bitmap laid out like fb, w columns by pages pages, to column x
+ * of page.  Anything off the screen is cut off.
+ */
+void fb_bitmap(u8 x, u8 page, u8 w, u8 pages, const u8 *bits) {
+	u8 p;
+	u8 i;
+
+	for (p = 0; p < pages && page + p < FB_PAGES; p++)
+		for (i = 0; i < w && x + i < WIDTH; i++)
+			fb_put(page + p, x + i, bits[p * w + i]);
+}
+
+/* Where putchar() writes next, as a text row and a pixel column */
+void textAt(unsigned char row, unsigned char col) {
+	textPage = row;
+	textX = col;
+}
+
+/* Everything in fmt.c writes through this */
 void putchar(char c) {
 	u8 i;
 
 	c &= 0x7f;
 
-	if (c >= FONT_OFFSET) {
+	if (c < FONT_OFFSET)
+		return;
+	if (textPage < FB_PAGES && textX <= WIDTH - (FONT_WIDTH + 1)) {
 		for (i = 0; i < FONT_WIDTH; i++)
-			txData(font[c - FONT_OFFSET][i]);
-		txData(0x00);
+			fb_put(textPage, textX + i, font[c - FONT_OFFSET][i]);
+		fb_put(textPage, textX + FONT_WIDTH, 0x00);
+	}
+	textX += FONT_WIDTH + 1;
+}
+
+/*
+ * Send the columns that changed since the last render, one setCursor() for
+ * each span.  The last of it is still going out on return, so lcd_wait()
+ * before stopping the clock.
+ */
+void display_render(void) {
+	u8 page;
+	u8 x;
+	u8 start;
+	u8 end;
+	u8 i;
+
+	for (page = 0; page < FB_PAGES; page++) {
+		x = 0;
+		while (x < WIDTH) {
+			if (fb_dirty[page][x >> 3] == 0) {
+				x = (x | 7) + 1;
+				continue;
+			}
+			if (!fb_is_dirty(page, x)) {
+				x++;
+				continue;
+			}
+
+			/* Carry on over gaps too short to be worth a seek */
+			start = x;
+			end = x + 1;
+			for (x++; x < WIDTH && x - end < FB_GAP; x++)
+				if (fb_is_dirty(page, x))
+					end = x + 1;
+
+			setCursor(page, start);
+			lcd_send(HIGH, &fb[page][start], end - start);
+			x = end;
+		}
+		for (i = 0; i < FB_DIRTY_BYTES; i++)
+			fb_dirty[page][i] = 0;
 	}
+	lcd_flush();
 }
@@ -22,12 +22,20 @@
  * Boston, MA 02110-1301, USA.
  */
 
+#include <stdbool.h>
+#include "types.h"
+
 #define LOW 0
 #define HIGH 1
 
 #define WIDTH  132
 #define HEIGHT 65
 
+/* The framebuffer covers the 8 full pages, not the icon row below them */
+#define FB_PAGES 8
+#define FB_HEIGHT (FB_PAGES * 8)
+#define FB_DIRTY_BYTES ((WIDTH + 7) / 8)
+
 #define DISPLAY_ON        0xaf
 #define DISPLAY_OFF       0xae
 
@@ -82,12 +90,16 @@ void setIOPorts();
 
 void configureSPI();
 
-void tx(unsigned char ch);
-
 void txData(unsigned char ch);
 
 void txCtl(unsigned char ch);
 
+void lcd_flush(void);
+
+bool lcd_busy(void);
+
+void lcd_wait(void);
+
 void LCDReset(void);
 
 void LCDPowerSave();
@@ -100,4 +112,14 @@ void setNormalReverse(unsigned char normal);
 
 void clear();
 
+void fb_pixel(u8 x, u8 y, bool on);
+
+void fb_line(u8 x0, u8 y0, u8 x1, u8 y1, bool on);
+
+void fb_bitmap(u8 x, u8 page, u8 w, u8 pages, const u8 *bits);
+
+void textAt(unsigned char row, unsigned char col);
+
 void putchar(char c);
+
+void display_render(void);
@@ -0,0 +1,84 @@
+/*
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2, or (at your option)
+ * any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; see the file COPYING.  If not, write to
+ * the Free Software Foundation, Inc., 51 Franklin Street,
+ * Boston, MA 02110-1301, USA.
+ */
+
+#include <cc1110.h>
+#include "ioCCxx10_bitdef.h"
+#include "dma.h"
+
+/* Descriptors for channels 1 - 4.  The DMA controller wants them contiguous. */
+static __xdata dma_desc dma_desc_tab[4];
+
+void dma_init(void) {
+    DMAARM = DMAARM_ABORT | DMAARM1 | DMAARM2 | DMAARM3 | DMAARM4;
+    DMA1CFGH = (u16)dma_desc_tab >> 8;
+    DMA1CFGL = (u16)dma_desc_tab;
+
+    DMAIRQ = 0;
+    DMAIF = 0;
+    DMAIE = 1;          // Enable DMA interrupt (IEN1.0)
+}
+
+__xdata dma_desc *dma_channel(u8 n) {
+    return &dma_desc_tab[n - 1];
+}
+
+/* The descriptor is fetched when the channel is armed, so set it up first. */
+void dma_arm(u8 n) {
+    DMAIRQ &= ~DMA_IRQ_BIT(n);
+    DMAARM |= DMA_ARM_BIT(n);
+}
+
+void dma_abort(u8 n) {
+    DMAARM = DMAARM_ABORT | DMA_ARM_BIT(n);
+}
+
+/*
+ * Copy len bytes between xdata addresses with channel n, as one block, and
+ * wait for it.  The radio registers at 0xDFxx are in reach, flash is not.
+ * Arming takes a few cycles to load the descriptor, which the call to
+ * dma_arm() covers before the request goes in.  No interrupt is raised.
+ */
+void dma_copy(u8 n, u16 dst, u16 src, u16 len) {
+    __xdata dma_desc *d = dma_channel(n);
+
+    DMA_SET_SRC(d, src);
+    DMA_SET_DST(d, dst);
+    DMA_SET_LEN(d, len);
+    d->cfg0 = DMA_WORDSIZE_BYTE | DMA_TMODE_BLOCK | DMA_TRIG_NONE;
+    d->cfg1 = DMA_SRCINC_1 | DMA_DESTINC_1 | DMA_M8_USE_8_BITS | DMA_PRI_HIGH;
+    dma_arm(n);
+    DMAREQ |= DMA_ARM_BIT(n);
+    while (DMAARM & DMA_ARM_BIT(n));
+}
+
+/*
+ * This is the interrupt vector for DMA_VECTOR.  One flag per channel in
+ * DMAIRQ tells us who finished.
+ */
+void dma_isr(void) __interrupt (DMA_VECTOR)
+{
+    DMAIF = 0;
+
+    if (DMAIRQ & DMA_IRQ_BIT(DMA_CH_RADIO)) {
+        DMAIRQ &= ~DMA_IRQ_BIT(DMA_CH_RADIO);
+        radio_dma_isr();
+    }
+    if (DMAIRQ & DMA_IRQ_BIT(DMA_CH_LCD)) {
+        DMAIRQ &= ~DMA_IRQ_BIT(DMA_CH_LCD);
+        lcd_dma_isr();
+    }
+}
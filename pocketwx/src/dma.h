@@ -0,0 +1,96 @@
+/*
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2, or (at your option)
+ * any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; see the file COPYING.  If not, write to
+ * the Free Software Foundation, Inc., 51 Franklin Street,
+ * Boston, MA 02110-1301, USA.
+ */
+
+#ifndef DMA_H
+#define DMA_H 1
+
+#include "types.h"
+
+/*
+ * DMA configuration data structure.  See Section 12.5.6 of the datasheet.
+ * Channel 0 is left alone because sleep() in pm.c borrows it for the PM3
+ * errata workaround.  Channels 1 - 4 share one block of descriptors.
+ */
+typedef struct {
+    u8 srcaddrh;
+    u8 srcaddrl;
+    u8 dstaddrh;
+    u8 dstaddrl;
+    u8 lenh;        /* VLEN[7:5] LEN[12:8] */
+    u8 lenl;        /* LEN[7:0] */
+    u8 cfg0;        /* WORDSIZE[7] TMODE[6:5] TRIG[4:0] */
+    u8 cfg1;        /* SRCINC[7:6] DESTINC[5:4] IRQMASK[3] M8[2] PRIORITY[1:0] */
+} dma_desc;
+
+/* Who owns which channel */
+#define DMA_CH_RADIO        1
+#define DMA_CH_COPY         2
+#define DMA_CH_LCD          3
+
+/* VLEN */
+#define DMA_VLEN_FIXED      (0x00 << 5)
+
+/* WORDSIZE */
+#define DMA_WORDSIZE_BYTE   (0x00 << 7)
+
+/* TMODE */
+#define DMA_TMODE_SINGLE            (0x00 << 5)
+#define DMA_TMODE_BLOCK             (0x01 << 5)
+#define DMA_TMODE_REPEATED_SINGLE   (0x02 << 5)
+#define DMA_TMODE_REPEATED_BLOCK    (0x03 << 5)
+
+/* TRIG */
+#define DMA_TRIG_NONE       0
+#define DMA_TRIG_URX0       14
+#define DMA_TRIG_UTX0       15
+#define DMA_TRIG_RADIO      19
+
+/* SRCINC / DESTINC */
+#define DMA_SRCINC_0        (0x00 << 6)
+#define DMA_SRCINC_1        (0x01 << 6)
+#define DMA_DESTINC_0       (0x00 << 4)
+#define DMA_DESTINC_1       (0x01 << 4)
+
+#define DMA_IRQMASK         0x08
+#define DMA_M8_USE_8_BITS   (0x00 << 2)
+
+/* PRIORITY */
+#define DMA_PRI_LOW         0x00
+#define DMA_PRI_GUARANTEED  0x01
+#define DMA_PRI_HIGH        0x02
+
+#define DMA_SET_SRC(d, a)   { (d)->srcaddrh = (u16)(a) >> 8; \
+                              (d)->srcaddrl = (u16)(a); }
+#define DMA_SET_DST(d, a)   { (d)->dstaddrh = (u16)(a) >> 8; \
+                              (d)->dstaddrl = (u16)(a); }
+#define DMA_SET_LEN(d, n)   { (d)->lenh = DMA_VLEN_FIXED | (((n) >> 8) & 0x1f); \
+                              (d)->lenl = (n); }
+
+/* Arm bit and IRQ flag for channel n, 1 to 4 */
+#define DMA_ARM_BIT(n)      (1 << (n))
+#define DMA_IRQ_BIT(n)      (1 << (n))
+
+void dma_init(void);
+__xdata dma_desc *dma_channel(u8 n);
+void dma_arm(u8 n);
+void dma_abort(u8 n);
+void dma_copy(u8 n, u16 dst, u16 src, u16 len);
+
+/* Completion handlers, called from dma_isr */
+void radio_dma_isr(void);
+void lcd_dma_isr(void);
+#endif
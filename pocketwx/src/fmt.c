@@ -0,0 +1,131 @@
+/*
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2, or (at your option)
+ * any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; see the file COPYING.  If not, write to
+ * the Free Software Foundation, Inc., 51 Franklin Street,
+ * Boston, MA 02110-1301, USA.
+ */
+
+#include "fmt.h"
+#include "display.h"
+
+/*
+ * Decimal digits come from subtracting powers of ten, at most nine times
+ * each, instead of from the 32-bit division and modulo sdcc does in
+ * software.  Being const, these stay in code space.
+ */
+#define DECADES 10
+static const u32 decade[DECADES] = {
+    1000000000, 100000000, 10000000, 1000000, 100000,
+    10000, 1000, 100, 10, 1
+};
+
+/* First entry of decade[] a u16 can reach */
+#define DECADE_U16 5
+
+static const char hex[16] = "0123456789abcdef";
+
+/* Digits of the last number converted, most significant first */
+static char digits[DECADES];
+static u8 ndigits;
+
+static void to_decimal(u32 v, u8 first) {
+    char d;
+
+    ndigits = 0;
+    for (; first < DECADES; first++) {
+        d = '0';
+        while (v >= decade[first]) {
+            v -= decade[first];
+            d++;
+        }
+        /* No leading zeros, but always at least the units */
+        if (d != '0' || ndigits != 0 || first == DECADES - 1)
+            digits[ndigits++] = d;
+    }
+}
+
+/* Pad to width, then the sign if there is one, then the digits */
+static void put_digits(u8 width, char sign) {
+    u8 i;
+    u8 n = ndigits;
+
+    if (sign)
+        n++;
+    for (; width > n; width--)
+        putchar(' ');
+    if (sign)
+        putchar(sign);
+    for (i = 0; i < ndigits; i++)
+        putchar(digits[i]);
+}
+
+void fmt_str(const char *s) {
+    while (*s)
+        putchar(*s++);
+}
+
+void fmt_hex8(u8 b) {
+    putchar(hex[b >> 4]);
+    putchar(hex[b & 0x0f]);
+}
+
+void fmt_hex16(u16 w) {
+    fmt_hex8(w >> 8);
+    fmt_hex8(w);
+}
+
+void fmt_u16(u16 v, u8 width) {
+    to_decimal(v, DECADE_U16);
+    put_digits(width, 0);
+}
+
+void fmt_u32(u32 v, u8 width) {
+    to_decimal(v, 0);
+    put_digits(width, 0);
+}
+
+void fmt_s16(s16 v, u8 width) {
+    if (v < 0) {
+        /* Through u16 so -32768 comes out right */
+        to_decimal((u16)-v, DECADE_U16);
+        put_digits(width, '-');
+    } else {
+        fmt_u16(v, width);
+    }
+}
+
+/*
+ * v in units of 10^-frac, as v / 10^frac with frac places after the point.
+ * The width includes the point, so fmt_fixed(v, 5, 1) is printf's
+ * "%3u.%u" of v / 10 and v % 10.
+ */
+void fmt_fixed(u16 v, u8 width, u8 frac) {
+    u8 i;
+
+    to_decimal(v, DECADE_U16);
+    /* Zeros in front so there is a digit before the point */
+    while (ndigits <= frac) {
+        for (i = ndigits; i > 0; i--)
+            digits[i] = digits[i - 1];
+        digits[0] = '0';
+        ndigits++;
+    }
+    i = frac != 0 ? ndigits + 1 : ndigits;
+    for (; width > i; width--)
+        putchar(' ');
+    for (i = 0; i < ndigits; i++) {
+        if (i == ndigits - frac && frac != 0)
+            putchar('.');
+        putchar(digits[i]);
+    }
+}
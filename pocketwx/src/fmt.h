@@ -0,0 +1,36 @@
+/*
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2, or (at your option)
+ * any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; see the file COPYING.  If not, write to
+ * the Free Software Foundation, Inc., 51 Franklin Street,
+ * Boston, MA 02110-1301, USA.
+ */
+
+#ifndef FMT_H
+#define FMT_H 1
+
+#include "types.h"
+
+/*
+ * Number formatting for the display, in place of printf.  Each writes
+ * through putchar() at the position set by textAt().  A width pads on the
+ * left with spaces, like printf's "%3u"; 0 means no padding.
+ */
+void fmt_str(const char *s);
+void fmt_hex8(u8 b);
+void fmt_hex16(u16 w);
+void fmt_u16(u16 v, u8 width);
+void fmt_u32(u32 v, u8 width);
+void fmt_s16(s16 v, u8 width);
+void fmt_fixed(u16 v, u8 width, u8 frac);
+
+#endif
@@ -0,0 +1,139 @@
+#!/usr/bin/env python3
+#
+# This program is free software; you can redistribute it and/or modify
+# it under the terms of the GNU General Public License as published by
+# the Free Software Foundation; either version 2, or (at your option)
+# any later version.
+#
+# This program is distributed in the hope that it will be useful,
+# but WITHOUT ANY WARRANTY; without even the implied warranty of
+# MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+# GNU General Public License for more details.
+#
+# You should have received a copy of the GNU General Public License
+# along with this program; see the file COPYING.  If not, write to
+# the Free Software Foundation, Inc., 51 Franklin Street,
+# Boston, MA 02110-1301, USA.
+
+"""
+Look for Davis frames in a dump of the raw capture ring.
+
+    framesearch.py DUMP [BURSTS]
+
+Turn capture on with the "C" key, wait for the burst count on the display to
+go up, and press "C" again to freeze the ring.  Then read it out with
+
+    goodfet.cc dumpdata DUMP 0xADDR 0xADDR+0x3ff
+
+using the address shown after CAP:.  DUMP may also be a raw binary copy of
+the ring.  Give the burst count shown, which stays up after capture stops,
+to list the bursts oldest first.  The number after R counts overflows.  Each
+one starts the ring and the count over, so only bursts since the last are
+in the dump in order.
+
+Every bit position of every burst is tried against the sync word, allowing
+one wrong bit the way the radio does.  What follows a match is printed with
+the bit order fixed, along with the shortest length the CRC is right over.
+"""
+
+import sys
+
+# Must match radio.h
+CAPTURE_BURST = 64
+CAPTURE_SIZE = 1024
+
+# SYNC1 and SYNC0 from radio.c, in the order the radio shifts bits in
+SYNC_WORD = 0xCB89
+SYNC_ERRORS = 1
+
+# Byte 0 upper nibble, from protocol.txt
+SENSORS = {
+    0x4: "UV", 0x6: "solar", 0x8: "temperature", 0xA: "humidity",
+    0xE: "rain",
+}
+
+
+def read_dump(path):
+    """The ring as bytes, from Intel hex or raw binary."""
+    with open(path, "rb") as f:
+        raw = f.read()
+    if not raw.startswith(b":"):
+        return raw[:CAPTURE_SIZE]
+
+    mem = {}
+    base = 0
+    for line in raw.decode("ascii").split():
+        rec = bytes.fromhex(line[1:])
+        count, addr, kind = rec[0], (rec[1] << 8) | rec[2], rec[3]
+        if kind == 0:
+            for i in range(count):
+                mem[base + addr + i] = rec[4 + i]
+        elif kind == 2:
+            base = ((rec[4] << 8) | rec[5]) << 4
+        elif kind == 4:
+            base = ((rec[4] << 8) | rec[5]) << 16
+    start = min(mem)
+    return bytes(mem.get(start + i, 0) for i in range(CAPTURE_SIZE))
+
+
+def crc16(data):
+    """CRC-16-CCITT with a zero start, as crc16_ccitt() in crc.c."""
+    crc = 0
+    for b in data:
+        crc ^= b << 8
+        for _ in range(8):
+            crc = ((crc << 1) ^ 0x1021) if crc & 0x8000 else crc << 1
+            crc &= 0xFFFF
+    return crc
+
+
+def bitrev(b):
+    return int("{:08b}".format(b)[::-1], 2)
+
+
+def search(burst):
+    """Yield (bit offset, frame bytes) for every sync word in a burst."""
+    bits = "".join("{:08b}".format(b) for b in burst)
+    want = "{:016b}".format(SYNC_WORD)
+    for i in range(len(bits) - 16):
+        errors = sum(a != b for a, b in zip(bits[i:i + 16], want))
+        if errors > SYNC_ERRORS:
+            continue
+        rest = bits[i + 16:]
+        rest = rest[:len(rest) - len(rest) % 8]
+        frame = bytes(bitrev(int(rest[j:j + 8], 2))
+                      for j in range(0, len(rest), 8))
+        yield i, frame
+
+
+def main(argv):
+    if len(argv) not in (2, 3):
+        sys.exit("usage: framesearch.py DUMP [BURSTS]")
+
+    ring = read_dump(argv[1])
+    slots = CAPTURE_SIZE // CAPTURE_BURST
+    if len(argv) == 3:
+        total = int(argv[2])
+        order = range(max(0, total - slots), total)
+    else:
+        order = range(slots)
+
+    for n in order:
+        slot = n % slots
+        burst = ring[slot * CAPTURE_BURST:(slot + 1) * CAPTURE_BURST]
+        for offset, frame in search(burst):
+            if len(frame) < 2:
+                continue
+            # The CRC stays good over zero fill, so only the first counts
+            good = [k for k in range(4, len(frame) + 1)
+                    if crc16(frame[:k]) == 0][:1]
+            sensor = SENSORS.get(frame[0] >> 4, "type %x" % (frame[0] >> 4))
+            print("burst %d bit %d: %s" %
+                  (n, offset, " ".join("%02x" % b for b in frame)))
+            print("    ID %d, %s, %s" %
+                  (frame[0] & 0x07, sensor,
+                   "CRC good over %d bytes" % good[0] if good else "no CRC"))
+
+
+if __name__ == "__main__":
+    main(sys.argv)
@@ -0,0 +1,130 @@
+#!/usr/bin/env python3
+#
+# This program is free software; you can redistribute it and/or modify
+# it under the terms of the GNU General Public License as published by
+# the Free Software Foundation; either version 2, or (at your option)
+# any later version.
+#
+# This program is distributed in the hope that it will be useful,
+# but WITHOUT ANY WARRANTY; without even the implied warranty of
+# MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+# GNU General Public License for more details.
+#
+# You should have received a copy of the GNU General Public License
+# along with this program; see the file COPYING.  If not, write to
+# the Free Software Foundation, Inc., 51 Franklin Street,
+# Boston, MA 02110-1301, USA.
+
+"""
+Generate the hop tables for one Davis region and each IM-ME crystal.
+
+    genhop.py REGION FREQ_REF [FREQ_REF ...]
+
+Writes hoptab.h and hoptab.c to the current directory, with one table of
+frequency words per crystal.  The firmware picks one at startup.  The
+Makefile runs this, so the firmware never has to work out a frequency word
+at run time.
+"""
+
+import sys
+
+# Order the US ISS visits its channels in, by position in frequency order
+US_ORDER = [
+    0, 19, 41, 25, 8, 47, 32, 13, 36, 22, 3, 29, 44, 16, 5, 27, 38, 10, 49,
+    21, 2, 30, 42, 14, 48, 7, 24, 34, 45, 1, 17, 39, 26, 9, 31, 50, 37, 12,
+    20, 33, 4, 43, 28, 15, 35, 6, 40, 11, 23, 46, 18,
+]
+
+
+def us_plan():
+    # 51 channels 501750.5 Hz apart, worked in half Hz to round exactly
+    return [(2 * 902382395 + ch * 1003501 + 1) // 2 for ch in US_ORDER]
+
+
+def rfm69_plan(words):
+    # Channel plans captured as RFM69 FRF words, 32 MHz / 2^19 Hz per step
+    return [(w * 32000000 + 2 ** 18) // 2 ** 19 for w in words]
+
+
+def eu_plan():
+    # From the DavisRFM69 library.  Not yet checked against an EU ISS.
+    return rfm69_plan([0xD90445, 0xD91304, 0xD90BA4, 0xD91A65, 0xD8FDC6])
+
+
+def au_plan():
+    # The DavisRFM69 AU table starts at FRF 0xE584DD and its first entries
+    # fall on a 156635 Hz grid in the US order.  All 51 channels are put on
+    # that grid here.  Check against the library table or an AU ISS.
+    return [918075700 + ch * 156635 for ch in US_ORDER]
+
+
+# name: (hop plan in Hz, band limits in MHz for manual tuning)
+REGIONS = {
+    "US": (us_plan, 902, 928),
+    "EU": (eu_plan, 863, 870),
+    "AU": (au_plan, 915, 928),
+}
+
+
+def word(freq, ref):
+    """Frequency word in FREQ_REF / 2^16 Hz steps, rounded to nearest."""
+    return (freq * 2 ** 17 + ref) // (2 * ref)
+
+
+def main(argv):
+    if len(argv) < 3 or argv[1] not in REGIONS:
+        sys.exit("usage: genhop.py %s FREQ_REF [FREQ_REF ...]" %
+                 "|".join(sorted(REGIONS)))
+
+    region = argv[1]
+    refs = [int(ref) for ref in argv[2:]]
+    # radio.c works frequency words and the data rate out in FREQ_REF / 64
+    for ref in refs:
+        if ref % 64:
+            sys.exit("genhop.py: crystal %d Hz is not a multiple of 64 Hz" %
+                     ref)
+    plan, band_min, band_max = REGIONS[region]
+    freqs = plan()
+    by_freq = sorted(freqs)
+    cmd = " ".join(["genhop.py"] + argv[1:])
+
+    with open("hoptab.h", "w") as f:
+        f.write("/* Generated by %s.  Do not edit. */\n\n" % cmd)
+        f.write("#ifndef HOPTAB_H\n#define HOPTAB_H 1\n\n")
+        f.write("#define HOP_REGION          \"%s\"\n" % region)
+        f.write("#define HOP_CHANNELS        %d\n" % len(freqs))
+        f.write("#define HOP_XTALS           %d\n" % len(refs))
+        f.write("#define HOP_FREQ_REF        %d\n" % refs[0])
+        f.write("#define HOP_FIRST_FREQ      %d\n" % freqs[0])
+        f.write("#define HOP_BAND_MIN_MHZ    %d\n" % band_min)
+        f.write("#define HOP_BAND_MAX_MHZ    %d\n" % band_max)
+        f.write("\n#endif\n")
+
+    with open("hoptab.c", "w") as f:
+        f.write("/* Generated by %s.  Do not edit. */\n\n" % cmd)
+        f.write("#include \"hop.h\"\n#include \"radio.h\"\n\n")
+        f.write("#if FREQ_REF != HOP_FREQ_REF\n")
+        f.write("#error \"hoptab.c is for another FREQ_REF.  Run make clean\"\n")
+        f.write("#endif\n\n")
+        f.write("/* Crystals the tables below are for, in the order to try them */\n")
+        f.write("const u32 hop_xtals[HOP_XTALS] = { %s };\n\n" %
+                ", ".join(str(ref) for ref in refs))
+        f.write("/*\n * The Davis %s hop sequence, in the order the ISS visits "
+                "the channels.\n * The comment is the channel's position in "
+                "frequency order.\n */\n" % region)
+        f.write("const hop_channel hop_tables[HOP_XTALS][HOP_CHANNELS] = {\n")
+        for n, ref in enumerate(refs):
+            f.write("    {   /* %d Hz */\n" % ref)
+            for i, freq in enumerate(freqs):
+                w = word(freq, ref)
+                sep = "," if i < len(freqs) - 1 else " "
+                f.write("        { %d, 0x%02x, 0x%02x, 0x%02x }%s   "
+                        "/* %2d */\n" %
+                        (freq, (w >> 16) & 0xff, (w >> 8) & 0xff, w & 0xff,
+                         sep, by_freq.index(freq)))
+            f.write("    }%s\n" % ("," if n < len(refs) - 1 else ""))
+        f.write("};\n")
+
+
+if __name__ == "__main__":
+    main(sys.argv)
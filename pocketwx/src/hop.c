@@ -0,0 +1,348 @@
+/*
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2, or (at your option)
+ * any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; see the file COPYING.  If not, write to
+ * the Free Software Foundation, Inc., 51 Franklin Street,
+ * Boston, MA 02110-1301, USA.
+ */
+
+#include "hop.h"
+#include "radio.h"
+#include "timer.h"
+
+/*
+ * The ISS transmits every 2.5 seconds plus 1/16 second per transmitter ID,
+ * moving to the next entry of the hop sequence each time.  See protocol.txt.
+ * Timer 1 ticks come from the crystal, so this has to be worked out for the
+ * one in use rather than taken from TIMER_HZ.
+ */
+#define HOP_PERIOD(id)      ((radio_xtal() * (40 + (id))) / 2048)
+
+/*
+ * Receive window either side of the predicted arrival.  It starts narrow and
+ * opens up by a step for every miss in a row, since the prediction gets
+ * worse the longer it goes without a packet to check it against.
+ */
+#define HOP_GUARD           MS_TO_TICKS(20)
+#define HOP_GUARD_STEP      MS_TO_TICKS(20)
+#define HOP_GUARD_MAX       MS_TO_TICKS(200)
+
+/*
+ * Timing filter.  The period is kept with HOP_FRAC fraction bits.  Each
+ * packet pulls the phase 1 / HOP_PHASE_GAIN and the period 1 / HOP_RATE_GAIN
+ * of the way towards what it says, and the period is not allowed further
+ * than 1 / HOP_RATE_LIMIT from nominal.  That is 0.2%, well past what two
+ * crystals should drift apart.
+ */
+#define HOP_FRAC            8
+#define HOP_PHASE_GAIN      2
+#define HOP_RATE_GAIN       8
+#define HOP_RATE_LIMIT      512
+
+/*
+ * Give up on a transmitter after this many misses in a row.  Slots it has to
+ * sit out for another one's are not misses, but the filter is moved on after
+ * this many of those so its arithmetic can't overflow.
+ */
+#define HOP_MAX_MISSES      8
+#define HOP_MAX_SLOTS       8
+
+#define HOP_NEXT(ch)        (((ch) + 1) == HOP_CHANNELS ? 0 : (ch) + 1)
+
+/* Receive window around a predicted arrival */
+#define HOP_OPEN(t)         ((t)->due - (t)->guard)
+#define HOP_CLOSE(t)        ((t)->due + (t)->guard)
+
+/*
+ * What is known about one transmitter.  They all follow the same hop
+ * sequence, each on its own clock.
+ */
+typedef struct {
+    bool synced;
+    u8 ch;          /* Channel it will use next */
+    u8 misses;      /* Misses in a row */
+    u8 slots;       /* Periods since last */
+    u32 period;     /* Period estimate, in ticks << HOP_FRAC */
+    u32 last;       /* Filtered arrival time of the last packet */
+    u32 due;        /* Predicted arrival on ch */
+    u32 guard;      /* Receive window either side of due */
+    u16 heard;      /* Running totals of slots heard and missed */
+    u16 missed;
+} hop_tx;
+
+/* Indexed by transmitter ID */
+static __xdata hop_tx hop_txs[HOP_IDS];
+
+/* The transmitter whose slot we are listening for, or HOP_NONE */
+static u8 hop_sel;
+
+/* Waiting for an unknown transmitter after hop_park() */
+static bool hop_parked;
+static u8 park_ch;
+static u32 park_open;
+static u32 park_close;
+
+/* Start over, with no idea where any transmitter is */
+void hop_init(void) {
+    u8 i;
+
+    for (i = 0; i < HOP_IDS; i++) {
+        hop_txs[i].synced = false;
+        hop_txs[i].heard = 0;
+        hop_txs[i].missed = 0;
+    }
+    hop_sel = HOP_NONE;
+    hop_parked = false;
+    park_ch = 0;
+}
+
+/*
+ * Pick the transmitter to listen for next: the one whose window opens first.
+ * When two windows overlap only one can be heard, so the one closer to
+ * losing sync wins, or failing that the earlier one.  The other sits the
+ * slot out.
+ */
+static void hop_schedule(void) {
+    __xdata hop_tx *t;
+    __xdata hop_tx *best;
+    u8 i;
+
+    hop_sel = HOP_NONE;
+    for (i = 0; i < HOP_IDS; i++) {
+        t = &hop_txs[i];
+        if (!t->synced)
+            continue;
+        if (hop_sel == HOP_NONE) {
+            hop_sel = i;
+            continue;
+        }
+
+        best = &hop_txs[hop_sel];
+        if (TIMER_EXPIRED(HOP_OPEN(t), HOP_CLOSE(best)))
+            continue;       /* Comes after, no overlap */
+        if (TIMER_EXPIRED(HOP_OPEN(best), HOP_CLOSE(t)))
+            hop_sel = i;    /* Comes before, no overlap */
+        else if (t->misses > best->misses)
+            hop_sel = i;
+        else if (t->misses == best->misses &&
+                 !TIMER_EXPIRED(HOP_OPEN(t), HOP_OPEN(best)))
+            hop_sel = i;
+    }
+}
+
+/* Channel of the slot we are after */
+u8 hop_current(void) {
+    if (hop_sel != HOP_NONE)
+        return hop_txs[hop_sel].ch;
+    return park_ch;
+}
+
+/* Transmitter ID of the slot we are after, or HOP_NONE */
+u8 hop_selected(void) {
+    return hop_sel;
+}
+
+/* True while following at least one transmitter */
+bool hop_is_synced(void) {
+    return hop_sel != HOP_NONE;
+}
+
+bool hop_is_parked(void) {
+    return hop_parked;
+}
+
+/* Mask of the transmitter IDs being followed, bit n for ID n */
+u8 hop_tracked(void) {
+    u8 mask = 0;
+    u8 i;
+
+    for (i = 0; i < HOP_IDS; i++) {
+        if (hop_txs[i].synced)
+            mask |= 1 << i;
+    }
+    return mask;
+}
+
+/* Predict the next arrival from the filter state */
+static void hop_predict(__xdata hop_tx *t) {
+    t->due = t->last + ((t->period * t->slots) >> HOP_FRAC);
+}
+
+/*
+ * Fold the arrival time of a packet into the phase and period estimates.  The
+ * error is spread over however many periods went by since the last packet.
+ */
+static void hop_track(__xdata hop_tx *t, u8 id, u32 when) {
+    s32 err = (s32)(when - t->due);
+    u32 nominal = HOP_PERIOD(id) << HOP_FRAC;
+
+    /* Too far out to be a timing error.  Start the phase over. */
+    if (err > (s32)t->guard || err < -(s32)t->guard) {
+        t->last = when;
+        return;
+    }
+
+    t->last = t->due + err / HOP_PHASE_GAIN;
+    t->period += (err * (1L << HOP_FRAC)) / ((s32)t->slots * HOP_RATE_GAIN);
+    if (t->period < nominal - nominal / HOP_RATE_LIMIT)
+        t->period = nominal - nominal / HOP_RATE_LIMIT;
+    if (t->period > nominal + nominal / HOP_RATE_LIMIT)
+        t->period = nominal + nominal / HOP_RATE_LIMIT;
+}
+
+/*
+ * A packet from transmitter id arrived on channel ch at the given time.  It
+ * will be on the next channel one period from then.  Returns the channel to
+ * tune to for whichever slot comes next.
+ */
+u8 hop_packet(u8 ch, u32 when, u8 id) {
+    __xdata hop_tx *t = &hop_txs[id];
+
+    if (t->synced) {
+        if (t->heard != 0xFFFF)
+            t->heard++;
+        hop_track(t, id, when);
+    } else {
+        /* New to us.  Start from the nominal period for its ID. */
+        t->period = HOP_PERIOD(id) << HOP_FRAC;
+        t->last = when;
+    }
+    t->slots = 1;
+    t->ch = HOP_NEXT(ch);
+    hop_predict(t);
+    t->guard = HOP_GUARD;
+    t->misses = 0;
+    t->synced = true;
+    hop_parked = false;
+    hop_schedule();
+
+    return hop_current();
+}
+
+/*
+ * Something that looked like a transmitter was heard on channel ch at the
+ * given time, but without a packet to say which one it was.  Wait for it on
+ * the next channel for as long as any ID could take.
+ */
+void hop_park(u8 ch, u32 when) {
+    park_ch = HOP_NEXT(ch);
+    park_open = when + HOP_PERIOD(0) - HOP_GUARD;
+    park_close = when + HOP_PERIOD(HOP_IDS - 1) + HOP_GUARD;
+    hop_parked = true;
+}
+
+/*
+ * Move a transmitter on to its next slot without having heard it.  The
+ * window for that one is a little wider.  Only a slot we were listening for
+ * counts as a miss.
+ */
+static void hop_advance(__xdata hop_tx *t, bool missed) {
+    if (t->slots == HOP_MAX_SLOTS) {
+        t->last = t->due;
+        t->slots = 0;
+    }
+    t->ch = HOP_NEXT(t->ch);
+    t->slots++;
+    hop_predict(t);
+    t->guard += HOP_GUARD_STEP;
+    if (t->guard > HOP_GUARD_MAX)
+        t->guard = HOP_GUARD_MAX;
+
+    if (!missed)
+        return;
+    if (t->missed != 0xFFFF)
+        t->missed++;
+    if (++t->misses >= HOP_MAX_MISSES)
+        t->synced = false;
+}
+
+/*
+ * Check for windows that have closed without a packet and move those
+ * transmitters on to the channels they are using now.  Returns true if the
+ * caller should retune.  When parked, running out the clock just ends the
+ * wait.
+ */
+bool hop_expired(u32 now) {
+    bool expired = false;
+    u8 i;
+
+    if (hop_parked) {
+        if (!TIMER_EXPIRED(now, park_close))
+            return false;
+        hop_parked = false;
+        return true;
+    }
+
+    for (i = 0; i < HOP_IDS; i++) {
+        if (hop_txs[i].synced && TIMER_EXPIRED(now, HOP_CLOSE(&hop_txs[i]))) {
+            hop_advance(&hop_txs[i], i == hop_sel);
+            expired = true;
+        }
+    }
+    if (expired)
+        hop_schedule();
+    return expired;
+}
+
+/*
+ * Give up on the current slot, for instance because the radio timed out
+ * waiting for a sync word, and go on to whichever slot is next.
+ */
+void hop_miss(void) {
+    if (hop_sel == HOP_NONE)
+        return;
+
+    hop_advance(&hop_txs[hop_sel], true);
+    hop_schedule();
+}
+
+/* When the receive window for the current slot closes */
+u32 hop_slot_end(void) {
+    if (hop_sel != HOP_NONE)
+        return HOP_CLOSE(&hop_txs[hop_sel]);
+    return park_close;
+}
+
+/* When the receive window for the current slot opens */
+u32 hop_expected(void) {
+    if (hop_sel != HOP_NONE)
+        return HOP_OPEN(&hop_txs[hop_sel]);
+    return park_open;
+}
+
+/*
+ * True if no receive window opens, or is open, between now and ticks from
+ * now, counting every transmitter followed and the parked channel.  For
+ * fitting in slow work like a recalibration.
+ */
+bool hop_quiet_for(u32 now, u32 ticks) {
+    u32 until = now + ticks;
+    u8 i;
+
+    if (hop_parked && !TIMER_EXPIRED(park_open, until))
+        return false;
+    for (i = 0; i < HOP_IDS; i++) {
+        if (hop_txs[i].synced &&
+            !TIMER_EXPIRED(HOP_OPEN(&hop_txs[i]), until))
+            return false;
+    }
+    return true;
+}
+
+/* Percentage of expected packets from transmitter id that showed up */
+u8 hop_rx_rate(u8 id) {
+    u16 total = hop_txs[id].heard + hop_txs[id].missed;
+
+    if (total == 0)
+        return 0;
+    return ((u32)hop_txs[id].heard * 100) / total;
+}
@@ -0,0 +1,63 @@
+/*
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2, or (at your option)
+ * any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; see the file COPYING.  If not, write to
+ * the Free Software Foundation, Inc., 51 Franklin Street,
+ * Boston, MA 02110-1301, USA.
+ */
+
+#ifndef HOP_H
+#define HOP_H 1
+
+#include <stdbool.h>
+#include "types.h"
+
+/*
+ * The hop set for the region picked in the Makefile, from genhop.py, with
+ * the frequency words for each crystal in the Makefile.  Channels are
+ * numbered in hop order.
+ */
+#include "hoptab.h"
+
+typedef struct {
+    /* frequency in Hz */
+    u32 freq;
+
+    /* frequency setting for the table's crystal */
+    u8 freq2;
+    u8 freq1;
+    u8 freq0;
+} hop_channel;
+
+extern const u32 hop_xtals[HOP_XTALS];
+extern const hop_channel hop_tables[HOP_XTALS][HOP_CHANNELS];
+
+/* One tracker per transmitter ID */
+#define HOP_IDS             8
+#define HOP_NONE            0xFF
+
+void hop_init(void);
+u8 hop_current(void);
+u8 hop_selected(void);
+bool hop_is_synced(void);
+bool hop_is_parked(void);
+u8 hop_tracked(void);
+u8 hop_packet(u8 ch, u32 when, u8 id);
+void hop_park(u8 ch, u32 when);
+bool hop_expired(u32 now);
+void hop_miss(void);
+u32 hop_slot_end(void);
+u32 hop_expected(void);
+bool hop_quiet_for(u32 now, u32 ticks);
+u8 hop_rx_rate(u8 id);
+
+#endif
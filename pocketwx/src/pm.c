@@ -21,6 +21,9 @@
 #include "ioCCxx10_bitdef.h"
 #include "types.h"
 #include "bits.h"
+#include "display.h"
+#include "timer.h"
+#include "pm.h"
 
 /* prepare an interrupt for the power button so it will wake us up */
 void setup_pm_interrupt() {
@@ -51,17 +54,33 @@ void port1_isr() __interrupt (P1INT_VECTOR) {
 	SLEEP &= ~SLEEP_MODE;
 }
 
+/* Set when a nap runs its full length, rather than the button ending it */
+static volatile __bit nap_done;
+
+/* sleep timer interrupt service routine, wakes us from nap() */
+void sleep_timer_isr() __interrupt (ST_VECTOR) {
+	/* clear the interrupt flags */
+	WORIRQ &= ~WORIRQ_EVENT0_FLAG;
+	STIF = 0;
+	nap_done = 1;
+
+	/* clear sleep mode bits */
+	SLEEP &= ~SLEEP_MODE;
+}
+
 /*
  * All this DMA and clock nonsense is based on the Errata Note (swrz022b) which
  * describes a workaround for "Part May Hang in Power Mode."  Timing is
  * critical here.  Do not edit this function without reading the Errata Note.
+ * The wake up source has to be set up before calling this.
  */
 
-void sleep() {
+static void power_down(u8 mode) {
 	volatile u8 desc_high = DMA0CFGH;
 	volatile u8 desc_low = DMA0CFGL;
 	__xdata u8 dma_buf[7] = {0x07,0x07,0x07,0x07,0x07,0x07,0x04};
 	__xdata u8 dma_desc[8] = {0x00,0x00,0xDF,0xBE,0x00,0x07,0x20,0x42};
+	u8 i;
 
 	/* switch to HS RCOSC */
 	SLEEP &= ~SLEEP_OSC_PD;
@@ -70,14 +89,17 @@ void sleep() {
 	while (!(CLKCON & CLKCON_OSC));
 	SLEEP |= SLEEP_OSC_PD;
 
-	setup_pm_interrupt();
-
 	/* store descriptors and abort any transfers */
 	desc_high = DMA0CFGH;
 	desc_low = DMA0CFGL;
 	DMAARM |= (DMAARM_ABORT | DMAARM0);
 
-	/* DMA prep */
+	/*
+	 * DMA prep.  The buffer is what gets written to SLEEP, so it has to
+	 * hold the mode asked for: 0x07 for PM3, 0x06 for PM2.
+	 */
+	for (i = 0; i < 6; i++)
+		dma_buf[i] = mode | SLEEP_OSC_PD;
 	dma_desc[0] = (u16)&dma_buf >> 8;
 	dma_desc[1] = (u16)&dma_buf;
 	DMA0CFGH = (u16)&dma_desc >> 8;
@@ -92,8 +114,8 @@ void sleep() {
 	/* disable flash cache */
 	MEMCTR |= MEMCTR_CACHD;
 
-	/* select sleep mode PM3 and power down XOSC */
-	SLEEP |= (SLEEP_MODE_PM3 | SLEEP_OSC_PD);
+	/* select sleep mode and power down XOSC */
+	SLEEP |= (mode | SLEEP_OSC_PD);
 
 	__asm
    	nop
@@ -101,7 +123,7 @@ void sleep() {
    	nop
 	__endasm;
 
-	if (SLEEP & SLEEP_MODE_PM3) {
+	if (SLEEP & SLEEP_MODE) {
 		__asm
 		mov 0xD7,#0x01 /* DMAREQ */
 		nop
@@ -121,3 +143,62 @@ void sleep() {
 	/* make sure HS RCOSC is stable */
 	while (!(SLEEP & SLEEP_HFRC_S));
 }
+
+/* PM3 until the power button is pressed */
+void sleep() {
+	setup_pm_interrupt();
+	power_down(SLEEP_MODE_PM3);
+}
+
+/*
+ * PM2 for about the given number of Timer 1 ticks, then back on the crystal.
+ * The power button still wakes us early.
+ *
+ * The sleep timer runs from the 32 kHz RC oscillator, which is calibrated to
+ * FREQ_REF / 750.  Timer 1 runs at FREQ_REF / 128 and stops in PM2, so the
+ * time asleep is converted and added to the timebase on the way out.  With a
+ * resolution of 32 sleep timer periods, one Event0 count is 187.5 Timer 1
+ * ticks.  Returns the number of Timer 1 ticks slept.  When the power button
+ * wakes us early that is what the sleep timer counted, not what was asked.
+ */
+u32 nap(u32 ticks) {
+	u32 event0 = (ticks * 2) / 375;
+	u8 t;
+	u8 lo;
+
+	if (event0 == 0)
+		return 0;
+	if (event0 > 0xFFFF)
+		event0 = 0xFFFF;
+
+	/* Reset the sleep timer.  It takes effect on its next clock edge. */
+	WORCTL = WORCTL_WOR_RES_32 | WORCTL_WOR_RESET;
+	t = WORTIME0;
+	while (t == WORTIME0);
+	WOREVT1 = event0 >> 8;
+	WOREVT0 = event0;
+
+	WORIRQ = WORIRQ_EVENT0_MASK;
+	nap_done = 0;
+	STIF = 0;
+	STIE = 1;           // Enable sleep timer interrupt (IEN0.5)
+	setup_pm_interrupt();
+
+	power_down(SLEEP_MODE_PM2);
+
+	/*
+	 * The sleep timer starts over at Event0, so its count only tells how
+	 * long a nap cut short was.  Reading WORTIME0 latches WORTIME1.
+	 */
+	if (!nap_done) {
+		lo = WORTIME0;
+		event0 = ((u16)WORTIME1 << 8) | lo;
+	}
+	STIE = 0;
+	WORIRQ = 0;
+	xtalClock();
+	ticks = (event0 * 375) / 2;
+	timer_advance(ticks);
+
+	return ticks;
+}
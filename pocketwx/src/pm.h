@@ -17,6 +17,10 @@
  * Boston, MA 02110-1301, USA.
  */
 
+#include "types.h"
+
 void setup_pm_interrupt();
 void port1_isr() __interrupt (P1INT_VECTOR);
+void sleep_timer_isr() __interrupt (ST_VECTOR);
 void sleep();
+u32 nap(u32 ticks);
@@ -21,80 +21,101 @@
 #include "ioCCxx10_bitdef.h"
 #include "display.h"
 #include "keys.h"
-#include "stdio.h"
+#include "fmt.h"
 #include "radio.h"
+#include "hop.h"
+#include "timer.h"
+#include "crc.h"
 #include "pocketwx.h"
 #include "pm.h"
+#include "dma.h"
 
 /* globals */
 __xdata channel_info chan_table[NUM_CHANNELS];
 u32 centerFreq;
 u32 userFreq;
 __bit sleepy;
-__bit packetDone;
-const __data u8 *pktbuf;
+__bit hopping;
+__bit capturing;
+/* The capture readout stays up after capture stops, until hopping again */
+__bit captureShown;
+u32 calTime;
+u16 calTemp;
+__bit dutyCycle;
+s16 afcGlobal;
+__bit afcGlobalValid;
+u32 statStart;
+u32 napTotal;
+u8 scanFloor;
+u8 statId;
 u8 ch;
-
-/* CRC calculation from http://www.menie.org/georges/embedded/ */
-u16 crc16_ccitt(const __data u8 *buf, u8 len)
-{
-    u16 crc = 0;
-    while( len-- ) {
-        int i;
-        crc ^= *(char *)buf++ << 8;
-        for( i = 0; i < 8; ++i ) {
-            if( crc & 0x8000 )
-                crc = (crc << 1) ^ 0x1021;
-            else
-                crc = crc << 1;
-        }
-    }
-    return crc;
-}
+u8 sniffCh;
+u8 xtalSel;
+__bit xtalKnown;
 
 void printDebugHeader() {
-    /* IM-ME display is 132W x 64H for a 22 x 8 character display */
-    SSN = LOW;
-    setCursor(0, 0);
-    printf("Freq:          Chan:");
-    setCursor(1, 0);
-    printf("Data:");
-    setCursor(3,0);
-    printf("CRC:");
-    setCursor(4,0);
-    printf("LQI:");
-    setCursor(5,0);
-    printf("RSSI:    NOW:");
-    setCursor(6,0);
-    printf("OFFSET:");
-    SSN = HIGH;
+    textAt(0, 0);
+    fmt_str("Freq:          Chan:");
+    textAt(1, 0);
+    fmt_str("Data:");
+    textAt(3, 0);
+    fmt_str("CRC:     BAD:");
+    textAt(4, 0);
+    fmt_str("LQI:     FIX:");
+    textAt(5, 0);
+    fmt_str("RSSI:    NOW:");
+    textAt(6, 0);
+    fmt_str("OFFSET:       OVR:");
+    textAt(7, 0);
+    fmt_str("DUTY:");
 }
 
 void printDebugFrequency(u32 freq, u8 ch) {
-    SSN = LOW;
-    setCursor(0, 30);
-    printf("%lu", freq);
-    setCursor(0, 120);
-    printf("%2u", ch);
-    SSN = HIGH;
-}
-
-void printDebugPacket() {
-    u16 crc = crc16_ccitt(pktbuf, 6);
-    SSN = LOW;
-    setCursor(1, 30);
-    printf("%02x %02x %02x %02x", pktbuf[0], pktbuf[1], pktbuf[2], pktbuf[3]);
-    setCursor(2, 30);
-    printf("%02x %02x %02x %02x", pktbuf[4], pktbuf[5], pktbuf[6], pktbuf[7]);
-    setCursor(3, 24);
-    printf("%04x", crc);
-    setCursor(4, 24);
-    printf("%3u ", pktbuf[9]);
-    setCursor(5, 30);
-    printf("%3u ", pktbuf[8]);
-    setCursor(6, 42);
-    printf("%3u ", pktbuf[10]);
-    SSN= HIGH;
+    textAt(AT_FREQ);
+    fmt_u32(freq, 0);
+    textAt(AT_CHAN);
+    fmt_u16(ch, 2);
+}
+
+void printDebugPacket(const __xdata radio_packet *pkt) {
+    const __xdata u8 *d = pkt->data;
+    u16 crc = crc16_ccitt(d, 6);
+    u8 i;
+    textAt(AT_DATA_LO);
+    for (i = 0; i < 8; i++) {
+        if (i == 4) {
+            /* Row 2 may be showing the capture readout */
+            if (captureShown)
+                break;
+            textAt(AT_DATA_HI);
+        } else if (i != 0) {
+            putchar(' ');
+        }
+        fmt_hex8(d[i]);
+    }
+    textAt(AT_CRC);
+    fmt_hex16(crc);
+    textAt(AT_LQI);
+    fmt_u16(pkt->lqi, 3);
+    putchar(' ');
+    textAt(AT_RSSI);
+    fmt_u16(pkt->rssi, 3);
+    putchar(' ');
+    textAt(AT_FREQEST);
+    fmt_s16((s8)pkt->freqest, 4);
+    putchar(' ');
+    if (!captureShown) {
+        textAt(AT_ID);
+        fmt_str("ID:");
+        fmt_u16(d[0] & 0x07, 0);
+    }
+}
+
+/* The capture readout covers the ID and bytes 4 - 7, so blank it after */
+void clearCapture() {
+    textAt(AT_CAPTURE);
+    fmt_str("                   ");
+    captureShown = 0;
 }
 
 void poll_keyboard() {
@@ -132,6 +153,36 @@ void poll_keyboard() {
 	case 'L':
 		userFreq += STEP_1MHZ;
 		break;
+	case 'x':
+	case 'X':
+		dutyCycle = !dutyCycle;
+		update_filter();
+		break;
+	case 'c':
+	case 'C':
+		/* raw capture on the current frequency, see framesearch.py */
+		capturing = !capturing;
+		if (capturing)
+			captureShown = 1;
+		hopping = 0;
+		radio_set_timeout(0);
+		radio_set_filter(RADIO_ALL_IDS, 0);
+		radio_set_profile(capturing ? RADIO_CAPTURE : RADIO_ACQUIRE);
+		centerFreq = setFrequency(centerFreq);
+		break;
+	case 'z':
+	case 'Z':
+		/* back to hopping after tuning by hand */
+		hopping = 1;
+		if (captureShown)
+			clearCapture();
+		capturing = 0;
+		hop_init();
+		scanFloor = SCAN_NO_FLOOR;
+		update_filter();
+		ch = hop_current();
+		tune(ch);
+		break;
 	case ' ':
 		/* pause */
 		while (getkey() == (u8)' ');
@@ -146,64 +197,529 @@ void poll_keyboard() {
 	}
 }
 
+/* Load the hop table for the crystal in use into chan_table */
+void init_channels() {
+    const hop_channel *hop = hop_tables[xtalSel];
+    u8 i;
+
+    for (i = 0; i < NUM_CHANNELS; i++) {
+        chan_table[i].freq = hop[i].freq;
+        chan_table[i].freq2 = hop[i].freq2;
+        chan_table[i].freq1 = hop[i].freq1;
+        chan_table[i].freq0 = hop[i].freq0;
+        chan_table[i].afc = AFC_DEFAULT * AFC_SCALE;
+        chan_table[i].afcValid = 0;
+        chan_table[i].ss = 0;
+        chan_table[i].max = 0;
+    }
+    afcGlobal = AFC_DEFAULT * AFC_SCALE;
+    afcGlobalValid = 0;
+}
+
+/* Offset to tune a channel with, rounded to whole FSCTRL0 steps */
+s8 afc_offset(u8 ch) {
+    s16 afc = chan_table[ch].afcValid ? chan_table[ch].afc : afcGlobal;
+
+    if (afc < 0)
+        return (afc - AFC_SCALE / 2) / AFC_SCALE;
+    return (afc + AFC_SCALE / 2) / AFC_SCALE;
+}
+
+/*
+ * Fold in FREQEST from a good packet heard on channel ch.  The first packet
+ * on a channel, or ever, sets the offset outright so we lock straight away.
+ */
+void afc_update(u8 ch, s8 freqest) {
+    s16 target = ((s16)afc_offset(ch) + freqest) * AFC_SCALE;
+
+    target = MAX(target, -128 * AFC_SCALE);
+    target = MIN(target, 127 * AFC_SCALE);
+
+    if (chan_table[ch].afcValid) {
+        chan_table[ch].afc += (target - chan_table[ch].afc) / AFC_GAIN;
+    } else {
+        chan_table[ch].afc = target;
+        chan_table[ch].afcValid = 1;
+    }
+
+    if (afcGlobalValid) {
+        afcGlobal += (target - afcGlobal) / AFC_GAIN;
+    } else {
+        afcGlobal = target;
+        afcGlobalValid = 1;
+    }
+}
+
+/* Read the on-chip temperature sensor.  About 4 counts per degree C. */
+u16 read_temperature() {
+    u8 lo;
+    u8 hi;
+
+    /* Writing ADCCON3 kicks off a single conversion */
+    ADCCON3 = ADCCON3_EREF_1_25V | ADCCON3_EDIV_512 | ADCCON3_ECH_TEMPR;
+    while (!(ADCCON1 & ADCCON1_EOC));
+    lo = ADCL;
+    hi = ADCH;
+
+    return (((u16)hi << 8) | lo) >> 4;
+}
+
+/*
+ * Calibrate the synthesizer once for every hop channel so tune() can skip the
+ * autocal.  Takes about 40 ms, so only do it between packets.
+ */
+void calibrate_channels() {
+    u8 i;
+
+    for (i = 0; i < NUM_CHANNELS; i++) {
+        radio_calibrate(chan_table[i].freq2, chan_table[i].freq1,
+                        chan_table[i].freq0);
+        chan_table[i].fscal3 = FSCAL3;
+        chan_table[i].fscal2 = FSCAL2;
+        chan_table[i].fscal1 = FSCAL1;
+    }
+
+    calTime = timer_now();
+    calTemp = read_temperature();
+}
+
+/*
+ * Set everything up for crystal n of hop_xtals.  Frequency words are in steps
+ * of the crystal, so on the wrong one every channel is out by 4%, some 35 MHz
+ * in the US band, and nothing is ever heard.  Takes about 40 ms.
+ */
+void select_xtal(u8 n) {
+    xtalSel = n;
+    radio_set_xtal(hop_xtals[n]);
+    init_channels();
+    calibrate_channels();
+}
+
+/*
+ * Until a good packet says which crystal this IM-ME has, take turns with the
+ * hop tables for each after every sweep.  Only the right one can hear the ISS.
+ */
+void next_xtal() {
+    if (!xtalKnown && HOP_XTALS > 1)
+        select_xtal(xtalSel + 1 == HOP_XTALS ? 0 : xtalSel + 1);
+}
+
+/* Saved calibration goes stale with time and with temperature drift */
+__bit calibration_due() {
+    u16 temp;
+
+    if (TIMER_EXPIRED(timer_now(), calTime + RECAL_INTERVAL))
+        return 1;
+
+    temp = read_temperature();
+    if (temp > calTemp + RECAL_TEMP_DELTA || calTemp > temp + RECAL_TEMP_DELTA)
+        return 1;
+
+    return 0;
+}
+
+/*
+ * Tune to a hop channel using its precomputed frequency word and calibration,
+ * and give up after timeout ticks without a sync word.  Zero for no limit.
+ */
+void select_channel(u8 ch) {
+    radio_set_offset(afc_offset(ch));
+    radio_set_channel(ch);
+    setFrequencyCal(chan_table[ch].freq2, chan_table[ch].freq1,
+                    chan_table[ch].freq0, chan_table[ch].fscal3,
+                    chan_table[ch].fscal2, chan_table[ch].fscal1);
+    centerFreq = chan_table[ch].freq;
+    userFreq = centerFreq;
+}
+
+void listen(u8 ch, u32 timeout) {
+    radio_set_timeout(timeout);
+    select_channel(ch);
+}
+
+/* Listen on a hop channel for as long as the hop timing says is worthwhile */
+void tune(u8 ch) {
+    u32 now = timer_now();
+
+    /* Bounded dwell: no point listening past the end of the slot */
+    if (hopping && hop_is_synced() && !TIMER_EXPIRED(now, hop_slot_end()))
+        listen(ch, hop_slot_end() - now);
+    else
+        listen(ch, 0);
+
+    chan_table[ch].ss = 0;
+    chan_table[ch].max = 0;
+    printDebugFrequency(centerFreq, ch);
+}
+
+/*
+ * Sweep the hop set once looking for the ISS.  A packet is 6 ms on the air,
+ * so a carrier is much easier to catch than a preamble.  Returns 1 if it
+ * heard something and parked the hop tracker on the channel after it.  A
+ * packet that happens to arrive during the sweep goes through pollPacket()
+ * as usual.  Takes about 40 ms, or twice that while the crystal is unknown.
+ */
+__bit scan() {
+    u8 i;
+    u8 rssi;
+    u8 quiet = SCAN_NO_FLOOR;
+    u32 until;
+
+    for (i = 0; i < NUM_CHANNELS; i++) {
+        listen(i, 0);
+        until = timer_now() + SCAN_SETTLE;
+        do {
+            radio_poll();
+        } while (radio_state() != RADIO_RX &&
+                 !TIMER_EXPIRED(timer_now(), until));
+
+        until = timer_now() + SCAN_DWELL;
+        while (!TIMER_EXPIRED(timer_now(), until));
+
+        rssi = RSSI ^ 0x80;
+        if ((u16)rssi > (u16)scanFloor + SCAN_MARGIN) {
+            hop_park(i, timer_now());
+            return 1;
+        }
+        quiet = MIN(quiet, rssi);
+    }
+
+    next_xtal();
+    scanFloor = quiet;
+    return 0;
+}
+
+/*
+ * Low power version of scan() for when we are duty cycling.  Sniff the next
+ * few channels, then nap out the rest of SNIFF_PERIOD.  A sniff that lands on
+ * a preamble goes on to receive the packet, which pollPacket() picks up as
+ * usual.  One that lands on the rest of a packet only has a carrier to go
+ * on, which shows as the sniff running its full length instead of being cut
+ * short.  That parks the hop tracker like scan() does.  Returns 1 if it
+ * parked.
+ */
+__bit sniff() {
+    u32 start = timer_now();
+    u32 begun;
+    u32 until;
+    u8 i;
+
+    for (i = 0; i < SNIFF_BATCH; i++) {
+        if (++sniffCh == NUM_CHANNELS) {
+            sniffCh = 0;
+            next_xtal();
+        }
+        begun = timer_now();
+        radio_set_sniff(SNIFF_TIME);
+        select_channel(sniffCh);
+
+        /*
+         * Quiet channels end by themselves long before this.  The tune may
+         * still be waiting for IDLE, so keep going through TUNE and RESTART.
+         */
+        until = begun + SCAN_SETTLE + SNIFF_TIME;
+        do {
+            radio_poll();
+        } while ((radio_state() == RADIO_TUNE ||
+                  radio_state() == RADIO_RESTART ||
+                  radio_state() == RADIO_SETTLE ||
+                  radio_state() == RADIO_RX) &&
+                 !TIMER_EXPIRED(timer_now(), until));
+        if (radio_queued())
+            return 0;
+
+        if (radio_state() == RADIO_RX) {
+            /* Still going, so it found a preamble.  Time for the rest. */
+            until += SNIFF_WAIT;
+            do {
+                radio_poll();
+            } while (radio_state() == RADIO_RX &&
+                     !TIMER_EXPIRED(timer_now(), until));
+            if (radio_queued())
+                return 0;
+        } else if (radio_state() != RADIO_TIMEOUT ||
+                   !TIMER_EXPIRED(timer_now(), begun + SNIFF_TIME)) {
+            continue;
+        }
+        hop_park(sniffCh, timer_now());
+        return 1;
+    }
+
+    display_render();
+    until = start + SNIFF_PERIOD;
+    if (radio_queued() == 0 && TIMER_EXPIRED(until, timer_now() + NAP_EARLY)) {
+        /* The USART stops in PM2 */
+        lcd_wait();
+        radio_sleep();
+        napTotal += nap(until - timer_now());
+        radio_wake();
+    }
+    return 0;
+}
+
+/*
+ * Only repair packets from transmitters we are following.  While dozing we
+ * only hear their slots anyway.  Awake, let anything in so new ones can be
+ * picked up between slots.  Following anything means the AFC has heard it,
+ * so the narrower tracking filter will do.
+ */
+void update_filter() {
+    u8 known = hop_tracked();
+
+    if (capturing)
+        radio_set_profile(RADIO_CAPTURE);
+    else if (known)
+        radio_set_profile(RADIO_TRACK);
+    else
+        radio_set_profile(RADIO_ACQUIRE);
+
+    if (dutyCycle && known)
+        radio_set_filter(known, known);
+    else
+        radio_set_filter(RADIO_ALL_IDS, known);
+}
+
+/*
+ * Called every pass of the main loop, well inside the timebase wrap.  Moving
+ * statStart up by half and halving napTotal with it keeps the proportion.
+ */
+void duty_window() {
+    u32 elapsed = timer_now() - statStart;
+
+    if (elapsed >= DUTY_WINDOW) {
+        statStart += elapsed / 2;
+        napTotal /= 2;
+    }
+}
+
+/* Percentage of time awake in tenths, over the last one to two DUTY_WINDOWs */
+u16 duty_permille() {
+    u32 elapsed = (timer_now() - statStart) >> 12;
+    u32 asleep = napTotal >> 12;
+
+    if (asleep > elapsed)
+        asleep = elapsed;
+
+    if (elapsed == 0)
+        return 1000;
+    return ((elapsed - asleep) * 1000) / elapsed;
+}
+
+void printDebugStats() {
+    u16 duty = duty_permille();
+    u8 known = hop_tracked();
+
+    /* Take turns showing the receive rate of each transmitter followed */
+    if (known) {
+        do {
+            statId = (statId + 1) & 0x07;
+        } while (!(known & (1 << statId)));
+    }
+
+    textAt(AT_DUTY);
+    fmt_fixed(duty, 5, 1);
+    putchar('%');
+    textAt(AT_RX_RATE);
+    fmt_str("RX");
+    fmt_u16(statId, 0);
+    putchar(':');
+    fmt_u16(hop_rx_rate(statId), 3);
+    putchar('%');
+    textAt(AT_OVERRUNS);
+    fmt_u16(radio_overruns(), 3);
+    textAt(AT_BAD);
+    fmt_u16(radio_crc_errors(), 3);
+    textAt(AT_FIX);
+    fmt_u16(radio_repairs(1) + radio_repairs(2), 3);
+}
+
+/*
+ * Sleep in PM2 until just before the next packet is due, then open the
+ * receive window on the channel the ISS will be using.  The window closes
+ * when hop_expired() says the slot has gone by.  Parked after a scan or
+ * sniff, that is the earliest any transmitter ID could be back.
+ */
+void doze() {
+    u32 now;
+    u32 wake = hop_expected() - NAP_EARLY;
+
+    /* Get the screen up to date first, since it can take a few ms */
+    display_render();
+    lcd_wait();
+    now = timer_now();
+    if ((hop_is_synced() || hop_is_parked()) &&
+        TIMER_EXPIRED(wake, now + NAP_MIN)) {
+        radio_sleep();
+        napTotal += nap(wake - now);
+        radio_wake();
+    }
+    tune(hop_current());
+}
+
+/*
+ * Work through the packets queued up by the radio.  Normally there is just
+ * the one, but a slow redraw can leave a few waiting.  Each stays in its ring
+ * slot until radio_release(), so the ISR can carry on filling the others.
+ */
 void pollPacket() {
-    if (packetDone) {
-        packetDone = 0;
-        printDebugPacket();
-        /* First and ten, do it again! */
-        centerFreq = setFrequency(centerFreq);
-        printDebugFrequency(centerFreq, 0);
-        chan_table[ch].ss = 0;
-        chan_table[ch].max = 0;
+    __xdata radio_packet *pkt;
+
+    while ((pkt = radio_peek()) != NULL) {
+        if (!radio_finalize(pkt)) {
+            radio_release();
+            continue;
+        }
+        /* First and ten, do it again!  Retune before the slow LCD work. */
+        if (hopping) {
+            /* Only good packets from the ISS get this far */
+            xtalKnown = 1;
+            afc_update(pkt->chan, pkt->freqest);
+            ch = hop_packet(pkt->chan, pkt->time, pkt->data[0] & 0x07);
+            update_filter();
+            /*
+             * Only the newest packet gets to retune.  The radio may not be
+             * idle if the packet turned up during a scan.
+             */
+            if (radio_queued() == 1) {
+                /*
+                 * The radio is idle, but with several transmitters followed
+                 * the next window may be only a few ms off.  Recalibrate only
+                 * if there is time to finish first.
+                 */
+                if (calibration_due() &&
+                    hop_quiet_for(timer_now(), RECAL_TIME))
+                    calibrate_channels();
+                if (!dutyCycle)
+                    tune(ch);
+            }
+        } else if (radio_queued() == 1 && radio_state() == RADIO_DONE) {
+            centerFreq = setFrequency(centerFreq);
+        }
+        printDebugPacket(pkt);
+        printDebugStats();
+        radio_release();
+        if (hopping && dutyCycle && radio_queued() == 0)
+            doze();
     }
 }
 
 void main(void) {
 	u16 i;
-    pktbuf = radio_getbuf();
+	__bit missed;
     ch = 0;
 
 reset:
 	centerFreq = DEFAULT_FREQ;
 	userFreq = centerFreq;
 	sleepy = 0;
-    packetDone = 0;
+    hopping = 1;
+    capturing = 0;
+    captureShown = 0;
+    dutyCycle = 1;
+    napTotal = 0;
+    scanFloor = SCAN_NO_FLOOR;
+    statId = 0;
+    sniffCh = 0;
 
 	xtalClock();
 	setIOPorts();
 	configureSPI();
+	/* The LCD is fed by DMA, finishing each run in the DMA interrupt */
+	dma_init();
+	EA = 1;
 	LCDReset();
 	radio_init();
+    timer_init();
+    /* Keeps whichever crystal was found before a power button reset */
+    select_xtal(xtalSel);
+    hop_init();
+    update_filter();
+    statStart = timer_now();
     clear();
     printDebugHeader();
-    setFrequency(centerFreq);
-    printDebugFrequency(centerFreq, ch);
+    ch = hop_current();
+    tune(ch);
 
 	while (1) {
+		duty_window();
 		poll_keyboard();
+        radio_poll();
         pollPacket();
 
         /* Show current RSSI */
-        SSN = LOW;
-        setCursor(5, 78);
-        printf("%3u", (RSSI ^ 0x80));
-        SSN = HIGH;
+        textAt(AT_RSSI_NOW);
+        fmt_u16(RSSI ^ 0x80, 3);
+        /* Where to dump the capture ring from, and how far round it is */
+        if (capturing) {
+            textAt(AT_CAPTURE);
+            fmt_str("CAP:");
+            fmt_hex16(radio_capture_addr());
+            putchar(' ');
+            fmt_u16(radio_capture_bursts(), 5);
+            fmt_str(" R");
+            fmt_u16(radio_capture_restarts(), 3);
+        }
+        display_render();
 
-        /* TODO Mod this when more than one channel */
+        /*
+         * Slot went by without a packet, as told by the radio timing out or
+         * by the clock.  Follow the ISS anyway.  Until then a timeout is
+         * just sniff() finding a quiet channel, and no slot was missed.
+         */
+        missed = 0;
+        if (hopping) {
+            if (radio_state() == RADIO_TIMEOUT &&
+                (hop_is_synced() || hop_is_parked())) {
+                hop_miss();
+                missed = 1;
+            } else {
+                missed = hop_expired(timer_now());
+            }
+        }
+        if (missed) {
+            /* May have lost one */
+            update_filter();
+            ch = hop_current();
+            printDebugStats();
+            if (dutyCycle)
+                doze();
+            else
+                tune(ch);
+        }
+
+        /* Not following the ISS yet.  Go looking for it. */
+        if (hopping && !hop_is_synced() && !hop_is_parked() &&
+            radio_queued() == 0) {
+            if (dutyCycle ? sniff() : scan()) {
+                ch = hop_current();
+                if (dutyCycle)
+                    doze();
+                else
+                    tune(ch);
+            }
+        }
+
+        /* Tuning by hand turns hopping off */
 		if (userFreq != centerFreq) {
+            userFreq = MAX(userFreq, (u32)MIN_BAND * 1000000);
+            userFreq = MIN(userFreq, (u32)MAX_BAND * 1000000);
+            hopping = 0;
+            radio_set_timeout(0);
+            radio_set_filter(RADIO_ALL_IDS, 0);
+            radio_set_profile(capturing ? RADIO_CAPTURE : RADIO_ACQUIRE);
 			centerFreq = setFrequency(userFreq);
             chan_table[ch].ss = 0;
             chan_table[ch].max = 0;
-            printDebugFrequency(centerFreq, ch);
+            /* Show where the synthesizer really ended up */
+            printDebugFrequency(
+                radio_word_to_freq(radio_freq_to_word(centerFreq)), ch);
         }
 
 		/* Go to sleep (more or less a shutdown) if power button pressed */
 		if (sleepy) {
 			clear();
 			sleepMillis(1000);
-			SSN = LOW;
 			LCDPowerSave();
-			SSN = HIGH;
 
 			while (1) {
 				sleep();
@@ -233,12 +749,6 @@ reset:
 //
 //         SSN = HIGH;
 
-/* Handle incoming packet. This is called within an ISR so keep it short. */
-void packet_rx_callback(const __data u8 *buf)
-{
-    packetDone = 1;
-}
-
 /*
  * "If you have multiple source fles in your project, interrupt service routines
  *  can be present in any of them, but a prototype of the isr MUST be present or
@@ -246,5 +756,6 @@ void packet_rx_callback(const __data u8 *buf)
  *   http://sdcc.sourceforge.net/doc/sdccman.pdf
  */
 
-void rftxrx_isr(void) __interrupt(RFTXRX_VECTOR);
 void rf_isr(void) __interrupt(RF_VECTOR);
+void dma_isr(void) __interrupt(DMA_VECTOR);
+void timer1_isr(void) __interrupt(T1_VECTOR);
@@ -18,10 +18,11 @@
  */
 
 /*
- * There is one channel per column of the display.  The radio is tuned to one
- * channel at a time and RSSI is displayed for that channel.
+ * There is one channel per entry in the hop table, numbered in hop order.  The
+ * radio is tuned to one channel at a time and RSSI is displayed for that
+ * channel.
  */
-#define NUM_CHANNELS 1
+#define NUM_CHANNELS HOP_CHANNELS
 
 /*
  * Normal IM-ME devices have a 26 MHz crystal, but
@@ -32,15 +33,97 @@
  */
 
 /* frequencies in Hz */
-#define DEFAULT_FREQ     (902382395)
+#define DEFAULT_FREQ     (HOP_FIRST_FREQ)
 #define STEP_1MHZ        (1000000)
 #define STEP_100KHZ      (100000)
 #define STEP_10KHZ       (10000)
 #define STEP_1KHZ        (1000)
 
-/* band limits in MHz */
-#define MIN_900  848
-#define MAX_900  962
+/* band limits in MHz for tuning by hand, from the region's hop table */
+#define MIN_BAND HOP_BAND_MIN_MHZ
+#define MAX_BAND HOP_BAND_MAX_MHZ
+
+/*
+ * Recalibrate the synthesizer for all channels after this long, or after the
+ * temperature sensor moves by this many counts (about 5 degrees C).
+ */
+#define RECAL_INTERVAL   ((u32)TIMER_HZ * 600)
+#define RECAL_TEMP_DELTA 20
+
+/* How long calibrate_channels() keeps the radio busy */
+#define RECAL_TIME       MS_TO_TICKS(40)
+
+/*
+ * Duty cycling between packets.  Wake this far ahead of the receive window
+ * to get the crystal going and the synthesizer settled, and do not bother
+ * sleeping for less than the minimum.
+ */
+#define NAP_EARLY        MS_TO_TICKS(5)
+#define NAP_MIN          MS_TO_TICKS(10)
+
+/*
+ * The timebase wraps after about 5.6 hours, so the duty cycle is worked out
+ * over a window.  Past this long the oldest half is dropped.
+ */
+#define DUTY_WINDOW      ((u32)TIMER_HZ * 3600)
+
+/*
+ * Acquisition.  Until the hop timing is known each channel in turn gets a
+ * listen just long enough for RSSI to settle.  A reading this many half dB
+ * steps over the quietest channel of the last sweep counts as the ISS.
+ */
+#define SCAN_SETTLE      MS_TO_TICKS(2)
+#define SCAN_DWELL       (TIMER_HZ / 2000)
+#define SCAN_MARGIN      20
+#define SCAN_NO_FLOOR    0xFF
+
+/*
+ * Acquisition while duty cycling.  Every SNIFF_PERIOD the next SNIFF_BATCH
+ * channels each get a sniff of up to SNIFF_TIME, long enough for a preamble
+ * to pass the quality threshold, and the rest of the period is spent in PM2.
+ * The radio ends a sniff by itself once RSSI is valid if there is no carrier,
+ * so most take well under SNIFF_TIME.  Going round the hop set takes about
+ * 130 ms against 40 ms for scan(), for around a sixth of the time in RX.
+ * SNIFF_WAIT is how long a sniff that found a preamble gets to turn it into
+ * a packet.
+ */
+#define SNIFF_PERIOD     MS_TO_TICKS(20)
+#define SNIFF_BATCH      8
+#define SNIFF_TIME       MS_TO_TICKS(2)
+#define SNIFF_WAIT       MS_TO_TICKS(10)
+
+/*
+ * Automatic frequency control.  FREQEST from every good packet is filtered
+ * per channel with a gain of 1 / AFC_GAIN and applied on the next visit.
+ * Channels not heard from yet borrow the average over all channels, since
+ * most of the error is our own crystal.
+ */
+#define AFC_DEFAULT      (-8)   /* FSCTRL0 = 248 from radio_init() */
+#define AFC_SCALE        16
+#define AFC_GAIN         4
+
+/*
+ * Screen layout, as row and pixel column for textAt().  The IM-ME display is
+ * 132W x 64H for a 22 x 8 character display.  The labels printed by
+ * printDebugHeader() go to the left of these.
+ */
+#define AT_FREQ          0, 30
+#define AT_CHAN          0, 120
+#define AT_DATA_LO       1, 30
+#define AT_DATA_HI       2, 30
+#define AT_ID            2, 0
+/* Over AT_ID and AT_DATA_HI, which aren't drawn while it is up */
+#define AT_CAPTURE       2, 0
+#define AT_CRC           3, 24
+#define AT_BAD           3, 78
+#define AT_LQI           4, 24
+#define AT_FIX           4, 78
+#define AT_RSSI          5, 30
+#define AT_RSSI_NOW      5, 78
+#define AT_FREQEST       6, 42
+#define AT_OVERRUNS      6, 108
+#define AT_DUTY          7, 30
+#define AT_RX_RATE       7, 72
 
 /* power button debouncing for wake from sleep */
 #define DEBOUNCE_COUNT  4
@@ -64,6 +147,10 @@ typedef struct {
 	u8 fscal2;
 	u8 fscal1;
 
+	/* frequency offset correction, in FSCTRL0 steps times AFC_SCALE */
+	s16 afc;
+	u8 afcValid;
+
 	/* signal strength */
 	u8 ss;
 	u8 max;
@@ -73,8 +160,25 @@ void clear();
 void putchar(char c);
 u8 getkey();
 void printHeader();
-u32 calibrate_freq(u32 freq, u8 ch);
+u16 read_temperature();
+void calibrate_channels();
+__bit calibration_due();
 u32 set_center_freq(u16 freq);
+void init_channels();
+void select_xtal(u8 n);
+void select_channel(u8 ch);
+void listen(u8 ch, u32 timeout);
 void tune(u8 ch);
+void next_xtal();
+__bit scan();
+__bit sniff();
+void clearCapture();
 void poll_keyboard();
+s8 afc_offset(u8 ch);
+void afc_update(u8 ch, s8 freqest);
+void update_filter();
+u16 duty_permille();
+void duty_window();
+void printDebugStats();
+void doze();
 void main(void);
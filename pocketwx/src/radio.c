@@ -28,30 +28,210 @@
 
 #include "display.h"
 #include "radio.h"
+#include "dma.h"
+#include "timer.h"
+#include "crc.h"
 #include "cc1110-ext.h"
 #include "ioCCxx10_bitdef.h"
 #include <cc1110.h>
 
 // #define DEBUG 1
 
-#define PKTBUF_MAX 11   /* Three extra bytes appended to packet */
+#define PKT_DMA_LEN 10  /* Payload plus RSSI and LQI */
+#define RING_MASK   (RADIO_RING_SIZE - 1)
 
-/* Rx packet buffer */
-static __data volatile u8 pktbuf[PKTBUF_MAX];
-static volatile u8 pktbuf_index = 0;
+/* MCSM0 with and without calibration on the way from IDLE to RX */
+#define MCSM0_AUTOCAL       0x18
+#define MCSM0_NO_AUTOCAL    0x08
 
-/* Flags */
-static volatile bool errflag = false;
-static volatile bool receiving = false;
-static volatile bool pkt_complete = false;
+/*
+ * MCSM2 for a sync word search of EVENT0 / 8, for a sniff of the same length
+ * that ends early without a carrier, or for no timeout at all
+ */
+#define MCSM2_TIMEOUT       (MCSM2_RX_TIME_QUAL | 0x00)
+#define MCSM2_SNIFF         (MCSM2_RX_TIME_RSSI | MCSM2_RX_TIME_QUAL | 0x00)
+#define MCSM2_NO_TIMEOUT    0x07
+
+/*
+ * With WOR_RES = 0 and RX_TIME = 0 the timeout is 1/8 of an Event0 period,
+ * and Event0 counts FREQ_REF / 750.  That makes one EVENT0 count 375 / 512
+ * of a Timer 1 tick, for a longest timeout of about 230 ms.
+ */
+#define TIMEOUT_MAX_TICKS   ((0xFFFFUL * 375) / 512)
+
+/* xdata address of RFD so the DMA controller can reach it */
+#define X_RFD_ADDR  0xDFD9
+
+/*
+ * The radio configuration registers, SYNC1 at 0xDF00 to FSCAL0 at 0xDF1F,
+ * as the DMA controller sees them.  A profile covers MDMCFG4 - FREND0.
+ */
+#define X_RADIO_REGS    0xDF00
+#define REGS_LEN        0x0C
+#define PROFILE_FIRST   0x0C
+#define PROFILE_LEN     0x10
+
+/* Offsets into radio_regs of the registers RADIO_CAPTURE changes */
+#define REG_PKTLEN      0x02
+#define REG_PKTCTRL1    0x03
+
+/*
+ * Rx packet ring.  Filled by DMA so it has to live in xdata.  radio_dma_isr()
+ * is the only writer of ring_head and the main loop the only writer of
+ * ring_tail, and a u8 store is atomic, so neither side has to mask interrupts.
+ * The slot at ring_head is never visible to the main loop, which makes it
+ * safe to aim the DMA channel at it.  One slot always stays empty.
+ */
+static __xdata radio_packet ring[RADIO_RING_SIZE];
+static volatile u8 ring_head = 0;
+static volatile u8 ring_tail = 0;
+
+/* Crystal frequency in Hz and the DRATE_M to go with it */
+static u32 xtal = FREQ_REF;
+static u8 drate_m;
+
+/* Modem profile loaded, and the one for the next tune */
+static volatile u8 profile;
+static u8 next_profile;
+
+/*
+ * Raw capture ring, filled by the radio DMA channel in repeated mode so it
+ * wraps by itself.  Burst n lands at (n % bursts per ring) * burst size.
+ * It sits at the top of RAM, over 0xFDA2 - 0xFEFF which is not retained in
+ * PM2 and PM3.  That is fine for the ring, since capturing stops hopping and
+ * so there are no naps until hopping starts again.  The Makefile keeps
+ * everything else below it.
+ */
+#define CAPTURE_ADDR    0xFB00
+static __xdata __at (CAPTURE_ADDR) u8 capture_buf[RADIO_CAPTURE_SIZE];
+static volatile u16 capture_bursts = 0;
+
+/*
+ * Overflows since capture was switched on.  Each one starts the ring over
+ * at slot 0 so bursts stay lined up with the slots, and capture_bursts
+ * with it, throwing away what came before.
+ */
+static volatile u8 capture_restarts = 0;
+
+/* Packets dropped because the main loop had not caught up */
+static volatile u16 overruns = 0;
+
+/* Packets thrown away for a CRC that was bad and couldn't be repaired */
+static volatile u16 crc_errors = 0;
+
+/* Packets saved by crc16_repair(), by number of bits flipped */
+static volatile u16 repairs1 = 0;
+static volatile u16 repairs2 = 0;
+
+/* Transmitter IDs to accept, and to repair, see radio_set_filter() */
+static volatile u8 accept_ids = RADIO_ALL_IDS;
+static volatile u8 known_ids = 0;
+
+/* Where the driver is.  See radio_poll(). */
+static volatile u8 rstate = RADIO_IDLE;
+
+/* Frequency word waiting to be loaded once the radio reaches IDLE */
+static u8 next_freq2;
+static u8 next_freq1;
+static u8 next_freq0;
+
+/* Frequency offset to go with it */
+static u8 next_fsctrl0 = 248;
 
-/* External access to buffer */
-__data volatile const u8 *radio_getbuf(void)
+/* RX timeout to go with it, see radio_set_timeout() */
+static u8 next_mcsm2 = MCSM2_NO_TIMEOUT;
+static u16 next_event0;
+
+/* The tune in progress is a sniff, see radio_set_sniff() */
+static bool sniffing;
+
+/* Channel to tag packets with */
+static u8 next_chan;
+
+/* Saved calibration to go with it, if any */
+static bool next_cal;
+static u8 next_fscal3;
+static u8 next_fscal2;
+static u8 next_fscal1;
+
+/* Channel tag for whatever is being received now */
+static u8 rx_chan;
+
+/* When its sync word came in, from the Timer 1 capture */
+static volatile u32 sfd_time;
+
+/*
+ * Oldest packet not yet released, or NULL if there is none.  Call from the
+ * main loop only.
+ */
+__xdata radio_packet *radio_peek(void)
+{
+    if (ring_tail == ring_head)
+        return NULL;
+    return &ring[ring_tail];
+}
+
+/* Hand the slot from radio_peek() back to the ISR */
+void radio_release(void)
+{
+    if (ring_tail != ring_head)
+        ring_tail = (ring_tail + 1) & RING_MASK;
+}
+
+/* Packets waiting for the main loop, counting the one radio_peek() returns */
+u8 radio_queued(void)
 {
-    return pktbuf;
+    return (ring_head - ring_tail) & RING_MASK;
 }
 
-/* Wait for MARCSTATE change */
+u16 radio_overruns(void)
+{
+    return overruns;
+}
+
+u16 radio_crc_errors(void)
+{
+    return crc_errors;
+}
+
+u16 radio_repairs(u8 bits)
+{
+    return bits == 1 ? repairs1 : repairs2;
+}
+
+/* Where the capture ring is, for reading it out with goodfet.cc dumpdata */
+u16 radio_capture_addr(void)
+{
+    return (u16)capture_buf;
+}
+
+/* Bursts started since capture was switched on, or restarted */
+u16 radio_capture_bursts(void)
+{
+    return capture_bursts;
+}
+
+/* Times an overflow started the capture ring over, up to 255 */
+u8 radio_capture_restarts(void)
+{
+    return capture_restarts;
+}
+
+/*
+ * Only pass on packets from the transmitter IDs in accept, a mask of
+ * RADIO_ID_BIT()s.  A packet that fails the CRC is only repaired if it then
+ * turns out to be from one of the IDs in known.
+ */
+void radio_set_filter(u8 accept, u8 known)
+{
+    accept_ids = accept;
+    known_ids = known;
+}
+
+/*
+ * Wait for MARCSTATE change.  This blocks for up to 255 ms, so it is only
+ * for radio_init().  Everything else goes through radio_poll().
+ */
 static bool wait_rfstate(u8 state)
 {
     u8 count = 0xFF;
@@ -68,64 +248,216 @@ static bool wait_rfstate(u8 state)
     return true;
 }
 
-u8 reverseBits(u8 b) {
-    /*
-     * The data bytes come over the air from the ISS least significant bit first.  Fix them as we go. From
-     * http://www.ocf.berkeley.edu/~wwu/cgi-bin/yabb/YaBB.cgi?board=riddles_cs;action=display;num=1103355188
-     */
-    b = ((b & 0b11110000) >>4 ) | ((b & 0b00001111) << 4);
-    b = ((b & 0b11001100) >>2 ) | ((b & 0b00110011) << 2);
-    b = ((b & 0b10101010) >>1 ) | ((b & 0b01010101) << 1);
+/*
+ * Point the radio DMA channel at the free ring slot and arm it.  Every RFTXRX
+ * trigger moves one byte from RFD, and the DMA interrupt fires once the whole
+ * packet and the two appended status bytes have landed.
+ */
+static void rx_dma_arm(void)
+{
+    __xdata dma_desc *d = dma_channel(DMA_CH_RADIO);
+
+    dma_abort(DMA_CH_RADIO);
+    DMA_SET_SRC(d, X_RFD_ADDR);
+    DMA_SET_DST(d, &ring[ring_head]);
+    DMA_SET_LEN(d, PKT_DMA_LEN);
+    d->cfg0 = DMA_WORDSIZE_BYTE | DMA_TMODE_SINGLE | DMA_TRIG_RADIO;
+    d->cfg1 = DMA_SRCINC_0 | DMA_DESTINC_1 | DMA_IRQMASK | DMA_M8_USE_8_BITS |
+              DMA_PRI_HIGH;
+    dma_arm(DMA_CH_RADIO);
+}
 
-    return(b);
+/*
+ * Stream raw bytes from RFD round the capture ring.  In repeated mode the
+ * channel reloads its descriptor at the end of the ring and carries on, so
+ * nothing is dropped and no interrupt is needed.
+ */
+static void capture_dma_arm(void)
+{
+    __xdata dma_desc *d = dma_channel(DMA_CH_RADIO);
+
+    dma_abort(DMA_CH_RADIO);
+    DMA_SET_SRC(d, X_RFD_ADDR);
+    DMA_SET_DST(d, capture_buf);
+    DMA_SET_LEN(d, RADIO_CAPTURE_SIZE);
+    d->cfg0 = DMA_WORDSIZE_BYTE | DMA_TMODE_REPEATED_SINGLE | DMA_TRIG_RADIO;
+    d->cfg1 = DMA_SRCINC_0 | DMA_DESTINC_1 | DMA_M8_USE_8_BITS | DMA_PRI_HIGH;
+    capture_bursts = 0;
+    dma_arm(DMA_CH_RADIO);
 }
 
-void radio_init(void) {
-    /* Enter idle */
-    RFST = RFST_SIDLE;
-    wait_rfstate(MARC_STATE_IDLE);
+/* Point the radio DMA channel wherever the loaded profile wants the bytes */
+static void arm_rx(void)
+{
+    if (profile == RADIO_CAPTURE)
+        capture_dma_arm();
+    else
+        rx_dma_arm();
+}
 
-    /*
-     * Remember: Min BW = 2*(Peak Deviation + Bit Rate)
-     *
-     * Remember also that the radio transmission is composed of
-     * - four preamble bytes in a 1010... pattern
-     * - two sync bytes
-     * - eight data bytes
-     *
-     * RF settings based on sniffing packets from a CC1021 in a Davis Weather
-     * console, figuring out what those meant, and plugging those values into
-     * TI Signal Studio. Also converted to a packet based format that is not
-     * supported on the CC1021.  Only registers differing from the default are
-     * initialized.
-     */
+/*
+ * The data bytes come over the air from the ISS least significant bit first.
+ * Fix them with one lookup per byte instead of the shift and mask passes from
+ * http://www.ocf.berkeley.edu/~wwu/cgi-bin/yabb/YaBB.cgi?board=riddles_cs;action=display;num=1103355188
+ * Being const, sdcc keeps this in code space where MOVC can reach it.
+ */
+static const u8 bitrev[256] = {
+    0x00, 0x80, 0x40, 0xc0, 0x20, 0xa0, 0x60, 0xe0, 0x10, 0x90, 0x50, 0xd0, 0x30, 0xb0, 0x70, 0xf0,
+    0x08, 0x88, 0x48, 0xc8, 0x28, 0xa8, 0x68, 0xe8, 0x18, 0x98, 0x58, 0xd8, 0x38, 0xb8, 0x78, 0xf8,
+    0x04, 0x84, 0x44, 0xc4, 0x24, 0xa4, 0x64, 0xe4, 0x14, 0x94, 0x54, 0xd4, 0x34, 0xb4, 0x74, 0xf4,
+    0x0c, 0x8c, 0x4c, 0xcc, 0x2c, 0xac, 0x6c, 0xec, 0x1c, 0x9c, 0x5c, 0xdc, 0x3c, 0xbc, 0x7c, 0xfc,
+    0x02, 0x82, 0x42, 0xc2, 0x22, 0xa2, 0x62, 0xe2, 0x12, 0x92, 0x52, 0xd2, 0x32, 0xb2, 0x72, 0xf2,
+    0x0a, 0x8a, 0x4a, 0xca, 0x2a, 0xaa, 0x6a, 0xea, 0x1a, 0x9a, 0x5a, 0xda, 0x3a, 0xba, 0x7a, 0xfa,
+    0x06, 0x86, 0x46, 0xc6, 0x26, 0xa6, 0x66, 0xe6, 0x16, 0x96, 0x56, 0xd6, 0x36, 0xb6, 0x76, 0xf6,
+    0x0e, 0x8e, 0x4e, 0xce, 0x2e, 0xae, 0x6e, 0xee, 0x1e, 0x9e, 0x5e, 0xde, 0x3e, 0xbe, 0x7e, 0xfe,
+    0x01, 0x81, 0x41, 0xc1, 0x21, 0xa1, 0x61, 0xe1, 0x11, 0x91, 0x51, 0xd1, 0x31, 0xb1, 0x71, 0xf1,
+    0x09, 0x89, 0x49, 0xc9, 0x29, 0xa9, 0x69, 0xe9, 0x19, 0x99, 0x59, 0xd9, 0x39, 0xb9, 0x79, 0xf9,
+    0x05, 0x85, 0x45, 0xc5, 0x25, 0xa5, 0x65, 0xe5, 0x15, 0x95, 0x55, 0xd5, 0x35, 0xb5, 0x75, 0xf5,
+    0x0d, 0x8d, 0x4d, 0xcd, 0x2d, 0xad, 0x6d, 0xed, 0x1d, 0x9d, 0x5d, 0xdd, 0x3d, 0xbd, 0x7d, 0xfd,
+    0x03, 0x83, 0x43, 0xc3, 0x23, 0xa3, 0x63, 0xe3, 0x13, 0x93, 0x53, 0xd3, 0x33, 0xb3, 0x73, 0xf3,
+    0x0b, 0x8b, 0x4b, 0xcb, 0x2b, 0xab, 0x6b, 0xeb, 0x1b, 0x9b, 0x5b, 0xdb, 0x3b, 0xbb, 0x7b, 0xfb,
+    0x07, 0x87, 0x47, 0xc7, 0x27, 0xa7, 0x67, 0xe7, 0x17, 0x97, 0x57, 0xd7, 0x37, 0xb7, 0x77, 0xf7,
+    0x0f, 0x8f, 0x4f, 0xcf, 0x2f, 0xaf, 0x6f, 0xef, 0x1f, 0x9f, 0x5f, 0xdf, 0x3f, 0xbf, 0x7f, 0xff
+};
+
+/*
+ * Remember: Min BW = 2*(Peak Deviation + Bit Rate)
+ *
+ * Remember also that the radio transmission is composed of
+ * - four preamble bytes in a 1010... pattern
+ * - two sync bytes
+ * - eight data bytes
+ *
+ * RF settings based on sniffing packets from a CC1021 in a Davis Weather
+ * console, figuring out what those meant, and plugging those values into
+ * TI Signal Studio. Also converted to a packet based format that is not
+ * supported on the CC1021.
+ *
+ * The settings are kept as images of the radio register block at 0xDFxx and
+ * copied in by DMA.  The CC1110 doesn't map flash into xdata where the DMA
+ * controller could read it, so the tables are in xdata and the startup code
+ * fills them in.  Registers not mentioned are at their reset values.
+ */
 
-    SYNC1 = 0xcb;       // Davis got the bit order swapped for the sync bytes.
-    SYNC0 = 0x89;       // They show up over the air from the ISS LSB first.
-    PKTLEN = 0x08;      // packet length - 8 bytes
-    PKTCTRL1 = 0xc4;    // Packet automation control 1
+/* SYNC1 - FREQ0, loaded once by radio_init() */
+static __xdata u8 radio_regs[REGS_LEN] = {
+    0xcb,               // SYNC1: Davis got the bit order swapped for the sync
+    0x89,               // SYNC0: bytes.  They show up LSB first from the ISS.
+    0x08,               // PKTLEN: packet length - 8 bytes
+    0xc4,               // PKTCTRL1: Packet automation control 1
                         // - Packet quality threshold = 24 (6*4)
                         // - Append RSSI and PQI
                         // - No address check
-    PKTCTRL0 = 0x00;    // packet automation control 0
+    0x00,               // PKTCTRL0: packet automation control 0
                         // Disable CRC check
                         // Fixed packet length mode
-    FSCTRL1 = 0x06;     // frequency synthesizer control
-    FSCTRL0 = 248;      // TODO. This is the freq offset for my IM-ME.
-                        // Make this adaptive later.
-    MDMCFG4 = 0xC9;     // modem configuration
-    MDMCFG3 = 0x75;     // modem configuration
-    MDMCFG2 = 0x11;     // modem configuration
-                        // GFSK modulation, not 2-FSK!
-                        // Match 15 out of 16 bits in sync word (0xd391)
-    MDMCFG0 = 0xE5;     // modem configuration
-                        // This sets channel spacing - don't really care.
-    DEVIATN = 0x13;     // modem deviation setting
-    MCSM0 = 0x18;       // main radio control state machine configuration
-                        //  - Autocal when going from IDLE to RX
-    FOCCFG = 0x37;      // frequency offset compensation configuration
-                        // Gate freq offset comp until CARRIER_SENSE high
-                        // Limit freq offset comp to +/-BWchan / 2
+    0x00,               // ADDR
+    0x00,               // CHANNR
+    0x06,               // FSCTRL1: frequency synthesizer control
+    248,                // FSCTRL0: Starting freq offset for my IM-ME.  The AFC
+                        // in pocketwx.c corrects it per channel from FREQEST
+    0x1e, 0xc4, 0xec    // FREQ2 - FREQ0: reset value, set by every tune
+};
+
+/*
+ * MDMCFG4 - FREND0 for each profile.  Until the AFC has learned this IM-ME's
+ * offset from the ISS the channel filter has to be wide enough for both
+ * crystals' worth of error.  After that a narrower filter lets in less noise,
+ * and the frequency offset compensation is held to small corrections.
+ * RADIO_CAPTURE drops the sync word search and starts a burst whenever the
+ * signal jumps by 10 dB, so frames with another sync word or length still
+ * get in.  MDMCFG3 is worked out for the crystal, see radio_set_xtal(), and
+ * MCSM2 and MCSM0 are set per tune.
+ */
+static __xdata u8 radio_profiles[RADIO_PROFILES][PROFILE_LEN] = {
+    {
+        0xC9,           // MDMCFG4: 105 kHz channel filter at 27 MHz
+        0x75,           // MDMCFG3: data rate, see radio_set_xtal()
+        0x11,           // MDMCFG2: GFSK modulation, not 2-FSK!
+                        // Match 15 out of 16 bits in sync word
+        0x22,           // MDMCFG1: reset value
+        0xE5,           // MDMCFG0: channel spacing - don't really care
+        0x13,           // DEVIATN: modem deviation setting
+        MCSM2_NO_TIMEOUT,
+        0x30,           // MCSM1: Drop to IDLE by itself at the end of a packet
+        MCSM0_AUTOCAL,
+        0x37,           // FOCCFG: Gate freq offset comp until CARRIER_SENSE
+                        // high.  Limit it to +/-BWchan / 2
+        0x6C,           // BSCFG: reset value
+        0x03,           // AGCCTRL2: reset value
+        0x40,           // AGCCTRL1: reset value
+        0x91,           // AGCCTRL0: reset value
+        0x56,           // FREND1: reset value
+        0x10            // FREND0: reset value
+    },
+    {
+        0xE9,           // MDMCFG4: 70 kHz channel filter at 27 MHz
+        0x75,
+        0x11,
+        0x22,
+        0xE5,
+        0x13,
+        MCSM2_NO_TIMEOUT,
+        0x30,
+        MCSM0_AUTOCAL,
+        0x36,           // FOCCFG: Limit freq offset comp to +/-BWchan / 4
+        0x6C,
+        0x03,
+        0x40,
+        0x91,
+        0x56,
+        0x10
+    },
+    {
+        0xC9,
+        0x75,
+        0x14,           // MDMCFG2: GFSK, no sync word, carrier sense only
+        0x22,
+        0xE5,
+        0x13,
+        MCSM2_NO_TIMEOUT,
+        0x3C,           // MCSM1: Stay in RX for the next burst
+        MCSM0_AUTOCAL,
+        0x37,
+        0x6C,
+        0x03,
+        0x60,           // AGCCTRL1: Carrier sense on a 10 dB jump in RSSI
+        0x91,
+        0x56,
+        0x10
+    }
+};
+
+/* Copy a modem profile into the registers.  The radio has to be in IDLE. */
+static void load_profile(u8 p)
+{
+    dma_copy(DMA_CH_COPY, X_RADIO_REGS + PROFILE_FIRST,
+             (u16)radio_profiles[p], PROFILE_LEN);
+    MDMCFG3 = drate_m;
+
+    /* Raw bursts are fixed length with nothing appended */
+    if (p == RADIO_CAPTURE) {
+        if (profile != RADIO_CAPTURE)
+            capture_restarts = 0;
+        PKTLEN = RADIO_CAPTURE_BURST;
+        PKTCTRL1 = 0x00;
+    } else {
+        PKTLEN = radio_regs[REG_PKTLEN];
+        PKTCTRL1 = radio_regs[REG_PKTCTRL1];
+    }
+    profile = p;
+}
+
+void radio_init(void) {
+    /* Enter idle */
+    RFST = RFST_SIDLE;
+    wait_rfstate(MARC_STATE_IDLE);
+
+    dma_copy(DMA_CH_COPY, X_RADIO_REGS, (u16)radio_regs, REGS_LEN);
+    radio_set_xtal(xtal);
+    load_profile(RADIO_ACQUIRE);
+    next_profile = RADIO_ACQUIRE;
+
     FSCAL3 = 0xE9;      // frequency synthesizer calibration
     FSCAL2 = 0x2A;      // frequency synthesizer calibration
     FSCAL1 = 0x00;      // frequency synthesizer calibration
@@ -137,112 +469,427 @@ void radio_init(void) {
 
     /* Enable interrupts as per Section 10.5.1 of the manual */
 
-    /* TODO Implement RFIF_IRQ_TIMEOUT at some point */
-    RFIM = RFIF_IRQ_DONE | RFIF_IRQ_RXOVF | RFIF_IRQ_SFD;
+    RFIM = RFIF_IRQ_DONE | RFIF_IRQ_RXOVF | RFIF_IRQ_SFD | RFIF_IRQ_TIMEOUT;
 
+    /*
+     * Received bytes are moved by DMA, so the RFTXRX interrupt stays off.  Its
+     * flag is still what triggers the DMA channel.
+     */
     RFIF = 0;           // Clear interrupt flags
-    RFTXRXIE = 1;       // Enable RF Tx / RX done interrupt enable (IEN0.0)
+    RFTXRXIE = 0;       // Disable RF Tx / RX done interrupt (IEN0.0)
     IEN2 |= IEN2_RFIE;  // Enable RF general interrupts
     EA = 1;             // Enable global interrupts
 }
 
-/* Set the radio frequency in Hz */
+/*
+ * Work the modem settings out for a crystal of ref Hz.  IM-MEs come with 26
+ * or 27 MHz crystals.  Only the data rate is far enough out to matter: with
+ * DRATE_E = 9 in MDMCFG4 it is (256 + DRATE_M) * ref / 2^19.  Bandwidth, IF
+ * and deviation are all within 4% either way.  ref must be a multiple of 64.
+ * Like the frequency words, the new rate goes in with the next tune, once the
+ * radio is in IDLE, rather than in the middle of a packet.
+ */
+void radio_set_xtal(u32 ref) {
+    u32 div = ref / 64;
+
+    xtal = ref;
+    drate_m = (((u32)RADIO_BAUD * 8192 + div / 2) / div) - 256;
+}
+
+/* Crystal frequency the radio is set up for */
+u32 radio_xtal(void) {
+    return xtal;
+}
+
+/*
+ * Frequency word for a frequency in Hz, rounded to the nearest step.  The
+ * word is in units of xtal / 2^16 Hz, which is (xtal / 64) / 2^10 Hz.
+ * Splitting off the whole steps first keeps everything in 32 bits without
+ * pulling in the float library.
+ */
+u32 radio_freq_to_word(u32 freq) {
+    u32 div = xtal / 64;
+    u32 whole = freq / div;
+    u32 rest = freq % div;
+
+    return (whole << 10) + ((rest << 10) + div / 2) / div;
+}
+
+/* Frequency in Hz for a frequency word, rounded to the nearest Hz */
+u32 radio_word_to_freq(u32 word) {
+    u32 div = xtal / 64;
+    u32 whole = word >> 10;
+    u32 rest = word & 0x3FF;
+
+    return whole * div + ((rest * div + 512) >> 10);
+}
+
+/*
+ * Set the radio frequency in Hz.  This does not wait for the synthesizer:
+ * it strobes IDLE and leaves the rest to radio_poll().
+ */
 u32 setFrequency(u32 freq) {
-    /* TODO Put FREQ_REF in the makefile */
-    u32 setting = (u32) (freq * (65536.0f/FREQ_REF) );
+    /* Right for whichever crystal radio_set_xtal() was last told about */
+    u32 setting = radio_freq_to_word(freq);
 
-    RFST = RFST_SIDLE;                /* We will autocal coming out of idle */
-    wait_rfstate(MARC_STATE_IDLE);
+    setFrequencyWord((setting >> 16) & 0xff, (setting >> 8) & 0xff,
+                     setting & 0xff);
+
+    return freq;
+}
+
+static void start_tune(u8 freq2, u8 freq1, u8 freq0) {
+    next_freq2 = freq2;
+    next_freq1 = freq1;
+    next_freq0 = freq0;
+
+    RFST = RFST_SIDLE;
     RFIF = 0;   /* Clear our interrupt flags to be on the safe side */
 
-    /* The frequency setting is in units of FREQ_REF/(2^16) Hz */
-    /* Be sure FREQ_REF is set correctly for your IM-ME in the Makefile *** */
+    rstate = RADIO_TUNE;
+    radio_poll();
+}
+
+/* Same as setFrequency() for a frequency word that is already worked out */
+void setFrequencyWord(u8 freq2, u8 freq1, u8 freq0) {
+    next_cal = false;               /* We will autocal coming out of idle */
+    start_tune(freq2, freq1, freq0);
+}
+
+/*
+ * Frequency offset for the next tune, in the same xtal / 2^14 Hz steps as
+ * FREQEST.  Adding FREQEST from a packet to the offset it was received with
+ * gives the offset that would have centered it.
+ */
+void radio_set_offset(s8 offset) {
+    next_fsctrl0 = offset;
+}
 
-    FREQ2 = (setting >> 16) & 0xff;
-    FREQ1 = (setting >> 8) & 0xff;
-    FREQ0 = setting & 0xff;
-    RFST = RFST_SRX;    /* We will autocal coming out of idle */
+/*
+ * Modem profile for the next tune, RADIO_ACQUIRE or RADIO_TRACK.  It is
+ * loaded once the radio is in IDLE.
+ */
+void radio_set_profile(u8 p) {
+    next_profile = p;
+}
 
-    /* Initialize flags while we wait */
-    errflag = false;
-    pkt_complete = false;
+/* Channel number to put in the packets heard after the next tune */
+void radio_set_channel(u8 chan) {
+    next_chan = chan;
+}
 
-    wait_rfstate(MARC_STATE_RX);
+/*
+ * Give up on the next tune if no sync word turns up within this many Timer 1
+ * ticks.  The radio drops to IDLE and radio_state() reports RADIO_TIMEOUT.
+ * Zero, or anything longer than the hardware can do, means no timeout.
+ * RX_TIME_QUAL keeps a packet that is already under way from being cut off.
+ */
+void radio_set_timeout(u32 ticks) {
+    if (ticks == 0 || ticks > TIMEOUT_MAX_TICKS) {
+        next_mcsm2 = MCSM2_NO_TIMEOUT;
+    } else {
+        next_mcsm2 = MCSM2_TIMEOUT;
+        next_event0 = (ticks * 512) / 375;
+    }
+}
 
-    return freq;
+/*
+ * Make the next tune a sniff of up to this many ticks.  This is the RX
+ * timeout of radio_set_timeout() with RX_TIME_RSSI added, so the radio gives
+ * up as soon as the RSSI is valid if there is no carrier, usually well short
+ * of the timeout.  A preamble still keeps it listening past the timeout.
+ * Without a packet it ends in RADIO_TIMEOUT either way.
+ */
+void radio_set_sniff(u32 ticks) {
+    radio_set_timeout(ticks);
+    if (next_mcsm2 == MCSM2_TIMEOUT)
+        next_mcsm2 = MCSM2_SNIFF;
 }
 
 /*
- * This is the interrupt vector for RFTXRX_VECTOR.  It is raised for us when Rx
- * data is ready in the RFD register.  See Section 13.3 of the datasheet.
- *
- * The format of the packet is this, totaling 11 bytes
- * - eight bytes from the ISS
- * - two bytes appended by the CC1110 for RSSI and LQI
- * - one byte appended in the code for the FREQEST offset error
+ * Tune with calibration results saved from radio_calibrate() for this same
+ * frequency word.  Skipping the autocal cuts the IDLE to RX time from about
+ * 800 us to under 100 us.
+ */
+void setFrequencyCal(u8 freq2, u8 freq1, u8 freq0,
+                     u8 fscal3, u8 fscal2, u8 fscal1) {
+    next_cal = true;
+    next_fscal3 = fscal3;
+    next_fscal2 = fscal2;
+    next_fscal1 = fscal1;
+    start_tune(freq2, freq1, freq0);
+}
+
+/*
+ * Run a manual calibration for a frequency word.  The results are left in
+ * FSCAL3, FSCAL2 and FSCAL1 for the caller to save.  This blocks for the
+ * roughly 720 us the calibration takes and leaves the radio in IDLE, so it is
+ * for use between packets only.
  */
-void rftxrx_isr(void) __interrupt RFTXRX_VECTOR
+void radio_calibrate(u8 freq2, u8 freq1, u8 freq0) {
+    u16 count;
+
+    dma_abort(DMA_CH_RADIO);
+    RFST = RFST_SIDLE;
+    count = 0xFFFF;
+    while (MARCSTATE != MARC_STATE_IDLE && --count);
+
+    FREQ2 = freq2;
+    FREQ1 = freq1;
+    FREQ0 = freq0;
+    RFST = RFST_SCAL;
+
+    /* Wait for it to start, then to finish */
+    count = 0xFFFF;
+    while (MARCSTATE == MARC_STATE_IDLE && --count);
+    while (MARCSTATE != MARC_STATE_IDLE && --count);
+
+    rstate = RADIO_IDLE;
+}
+
+/*
+ * Advance the driver as MARCSTATE catches up with the last strobe.  Call this
+ * from the main loop.  It never waits, so the caller is free to draw while
+ * the synthesizer calibrates and settles.
+ */
+void radio_poll(void)
+{
+    u8 marc = MARCSTATE & MARCSTATE_MARC_STATE;
+
+    switch (rstate) {
+    case RADIO_TUNE:
+        /* The frequency registers may only be changed in IDLE */
+        if (marc != MARC_STATE_IDLE)
+            break;
+        if (next_profile != profile)
+            load_profile(next_profile);
+        MDMCFG3 = drate_m;
+        FREQ2 = next_freq2;
+        FREQ1 = next_freq1;
+        FREQ0 = next_freq0;
+        FSCTRL0 = next_fsctrl0;
+        rx_chan = next_chan;
+        WORCTL = WORCTL_WOR_RES_1;
+        WOREVT1 = next_event0 >> 8;
+        WOREVT0 = next_event0;
+        MCSM2 = next_mcsm2;
+        sniffing = next_mcsm2 == MCSM2_SNIFF;
+        if (next_cal) {
+            FSCAL3 = next_fscal3;
+            FSCAL2 = next_fscal2;
+            FSCAL1 = next_fscal1;
+            MCSM0 = MCSM0_NO_AUTOCAL;
+        } else {
+            MCSM0 = MCSM0_AUTOCAL;
+        }
+        arm_rx();           /* Must be armed before the first byte arrives */
+        RFST = RFST_SRX;
+        rstate = RADIO_SETTLE;
+        break;
+    case RADIO_RESTART:
+        if (marc != MARC_STATE_IDLE)
+            break;
+        arm_rx();
+        RFST = RFST_SRX;
+        rstate = RADIO_SETTLE;
+        break;
+    case RADIO_SETTLE:
+        if (marc == MARC_STATE_RX)
+            rstate = RADIO_RX;
+        break;
+    case RADIO_RX:
+        /* A sniff cut short for want of a carrier is as good as a timeout */
+        if (sniffing && marc == MARC_STATE_IDLE)
+            rstate = RADIO_TIMEOUT;
+        break;
+    default:
+        break;
+    }
+}
+
+/*
+ * Park the radio before going to PM2.  Anything half received is dropped and
+ * the next tune starts from scratch.
+ */
+void radio_sleep(void)
+{
+    dma_abort(DMA_CH_RADIO);
+    RFST = RFST_SIDLE;
+    rstate = RADIO_IDLE;
+}
+
+/* TEST2 - TEST0 are not retained in PM2 and PM3 */
+void radio_wake(void)
 {
+    TEST2 = 0x81;
+    TEST1 = 0x35;
+    TEST0 = 0x09;
+}
+
+u8 radio_state(void)
+{
+    return rstate;
+}
+
+/*
+ * Called from dma_isr when the radio DMA channel has finished.  See Section
+ * 13.3 of the datasheet for the RFTXRX trigger.  Keep this short.  The bit
+ * reversal used to be left to radio_finalize(), but the CRC and ID checks
+ * need the bytes the right way round and are done here so that false syncs
+ * and other transmitters never take a ring slot.  Writing each byte back as
+ * it goes through the CRC is one more store a byte, cheaper than reversing
+ * them again later.  Anything slow, like a CRC repair, is for
+ * radio_finalize().
+ */
+void radio_dma_isr(void)
+{
+    __xdata radio_packet *pkt = &ring[ring_head];
+    u8 next = (ring_head + 1) & RING_MASK;
+    u16 crc = 0;
+    u8 i;
+
     /*
-     * 13.3.1.1 says to clear the IRQ before reading RFD, or else this can screw
-     * up the automatic append of the status bytes to the end of the packet.
+     * Finished.  MCSM1 has already sent the radio back to IDLE, so the
+     * frequency error can be read without strobing or waiting.
      */
+    pkt->freqest = FREQEST;
 
-    RFIF &= ~(RFIF_IRQ_DONE);
-
-    if (MARCSTATE == MARC_STATE_RX) {
-        /* Fetch next byte. Remember we are using fixed length packets. */
-        if (pktbuf_index < PKTBUF_MAX - 1)
-            pktbuf[pktbuf_index] = RFD;
-
-        /* Bytes from the ISS are in wrong bit order.  Sigh */
-        /* We've post incremented, so be sure to back up by one */
-        if (pktbuf_index < PKTBUF_MAX - 3)
-            pktbuf[pktbuf_index] = reverseBits(pktbuf[pktbuf_index]);
-
-        pktbuf_index++;
-
-        /* Finished. Read the frequency error.  Must be idle to do this. */
-        if (pktbuf_index == PKTBUF_MAX - 1) {
-            RFST = RFST_SIDLE;
-            wait_rfstate(MARC_STATE_IDLE);
-            pkt_complete = true;
-            pktbuf[PKTBUF_MAX - 3] ^= 0x80;     /* Normalize RSSI value */
-            pktbuf[PKTBUF_MAX - 2] &= 0x7f;     /* Clear CRC flag bit */
-            pktbuf[PKTBUF_MAX - 1] = FREQEST;
-            packet_rx_callback(radio_getbuf());
+    /*
+     * Bytes from the ISS are in wrong bit order.  Sigh.  Fix them and run
+     * the CRC in the same pass, so garbage from a false sync word never gets
+     * as far as the main loop.  Listen again on the same channel instead.
+     */
+    for (i = 0; i < sizeof(pkt->data); i++) {
+        pkt->data[i] = bitrev[pkt->data[i]];
+        CRC16_UPDATE(crc, pkt->data[i]);
+    }
+
+    /*
+     * When following a transmitter a packet is expected, so a bit or two
+     * gone wrong is worth fixing.  Otherwise it is too likely to be noise.
+     * The repair can take a few ms, too long to hold off the LCD and the
+     * other interrupts, so radio_finalize() does it from the main loop.  Its
+     * ID can't be trusted until then either.
+     */
+    pkt->syndrome = crc;
+    if (crc != 0 && known_ids == 0) {
+        crc_errors++;
+        rstate = RADIO_RESTART;
+        return;
+    }
+    if (crc == 0 && !(accept_ids & RADIO_ID_BIT(pkt->data[0]))) {
+        rstate = RADIO_RESTART;
+        return;
+    }
+
+    pkt->chan = rx_chan;
+    pkt->time = sfd_time;
+    rstate = RADIO_DONE;
+
+    /*
+     * With the ring full the slot stays where it is and the next packet
+     * lands on top of this one.
+     */
+    if (next == ring_tail) {
+        overruns++;
+        return;
+    }
+    ring_head = next;
+}
+
+/*
+ * Turn a raw packet from radio_peek() into something usable.  Call it once
+ * per packet, before looking at the status bytes.  Returns false for a packet
+ * that failed the CRC and couldn't be repaired, which is only counted and
+ * should be released unused.
+ *
+ * Of the 11 bytes DMA and radio_dma_isr() leave in the record
+ * - eight bytes from the ISS, already bit reversed and CRC checked
+ * - two bytes appended by the CC1110 for RSSI and LQI
+ * - one byte appended in the code for the FREQEST offset error
+ */
+bool radio_finalize(__xdata radio_packet *pkt)
+{
+    u16 crc;
+    u8 fixed;
+    u8 i;
+
+    pkt->rssi ^= 0x80;      /* Normalize RSSI value */
+    pkt->lqi &= 0x7f;       /* Clear CRC flag bit */
+
+    if (pkt->syndrome == 0)
+        return true;
+    fixed = crc16_repair(pkt->data, pkt->syndrome);
+    pkt->syndrome = 0;
+    if (fixed) {
+        /* Check the repair against the whole packet again */
+        crc = 0;
+        for (i = 0; i < sizeof(pkt->data); i++)
+            CRC16_UPDATE(crc, pkt->data[i]);
+        if (crc == 0 && (known_ids & RADIO_ID_BIT(pkt->data[0]))) {
+            if (fixed == 1)
+                repairs1++;
+            else
+                repairs2++;
+            return true;
         }
-    } else
-        errflag = true;
+    }
+
+    crc_errors++;
+    /* Listen again if nothing has moved the radio on since this packet */
+    if (radio_queued() == 1 && rstate == RADIO_DONE)
+        rstate = RADIO_RESTART;
+    return false;
 }
 
 /*
  * This is the interrupt vector for RF_VECTOR (#16)
  * All other general interrupts flags are in the RFIF register.
- * At some point we'll also want to work with IRQ_TIMEOUT
  */
-void rf_isr(void) __interrupt RF_VECTOR
+void rf_isr(void) __interrupt (RF_VECTOR)
 {
     /* Clear flags */
     S1CON &= ~(S1CON_RFIF_1 + S1CON_RFIF_0);
 
-    /* The RFIF_IRQ_DONE flag will be handled by rftxrx_isr */
+    /*
+     * Packet completion is signalled by the DMA interrupt instead, except in
+     * RADIO_CAPTURE where the DMA channel never stops.  Count the bursts so
+     * the ring can be put back in order.  The flag is cleared in every
+     * profile, or it would keep raising this interrupt.
+     */
+    if (RFIF & RFIF_IRQ_DONE)
+    {
+        RFIF &= ~RFIF_IRQ_DONE;
+        if (profile == RADIO_CAPTURE)
+            capture_bursts++;
+    }
 
-    /* Start of frame delimiter */
+    /*
+     * Start of frame delimiter.  Timer 1 latched the count as the interrupt
+     * was raised, so the time is good however late we got here.
+     */
     if (RFIF & RFIF_IRQ_SFD)
     {
         RFIF &= ~RFIF_IRQ_SFD;
-        pktbuf_index = 0;
+        sfd_time = timer_capture();
+    }
+
+    /* No sync word before the RX timeout.  MCSM1 has us in IDLE already. */
+    if (RFIF & RFIF_IRQ_TIMEOUT)
+    {
+        RFIF &= ~RFIF_IRQ_TIMEOUT;
+        dma_abort(DMA_CH_RADIO);
+        rstate = RADIO_TIMEOUT;
     }
 
-    /* Errors TODO Handle timeout */
-    /* if ((RFIF & RFIF_IRQ_RXOVF) || (RFIF & RFIF_IRQ_TIMEOUT)) */
+    /* Errors */
     if (RFIF & RFIF_IRQ_RXOVF)
     {
         RFIF &= ~RFIF_IRQ_RXOVF;
-        RFST = RFST_SIDLE;
-        wait_rfstate(MARC_STATE_IDLE);
-        pktbuf_index = 0;
-        errflag = true;
+        RFST = RFST_SIDLE;      /* Only way out of RX_OVERFLOW */
+        dma_abort(DMA_CH_RADIO);        /* Partial packet, throw it away */
+        rstate = RADIO_RESTART; /* radio_poll() restarts RX once IDLE */
+        if (profile == RADIO_CAPTURE && capture_restarts != 0xFF)
+            capture_restarts++;
     }
 }
@@ -2,16 +2,96 @@
 #define RADIO_H 1
 
 #include <stdbool.h>
+#include <stddef.h>
 #include "types.h"
 
+/*
+ * The crystal assumed until radio_set_xtal() says otherwise.  Timer constants
+ * are worked out from it at compile time.
+ */
 #ifndef FREQ_REF
 #define FREQ_REF    (27000000)
 #endif
 
+/* Air data rate, which radio_set_xtal() keeps the same for any crystal */
+#define RADIO_BAUD  19200
+
+/* Driver states returned by radio_state() */
+#define RADIO_IDLE      0   /* Nothing going on */
+#define RADIO_TUNE      1   /* Waiting for IDLE to load a new frequency */
+#define RADIO_RESTART   2   /* Waiting for IDLE to restart RX after an error */
+#define RADIO_SETTLE    3   /* Calibrating and settling on the way to RX */
+#define RADIO_RX        4   /* Listening */
+#define RADIO_DONE      5   /* Packet received, radio back in IDLE */
+#define RADIO_TIMEOUT   6   /* No sync word in time, radio back in IDLE */
+
+/*
+ * One received packet.  The DMA channel fills data, rssi and lqi straight
+ * from RFD, so those have to stay first and in this order.
+ */
+typedef struct {
+    u8 data[8];     /* Payload from the ISS */
+    u8 rssi;        /* Appended by the CC1110 */
+    u8 lqi;         /* Appended by the CC1110, CRC_OK in bit 7 */
+    u8 freqest;     /* Frequency error, read at the end of the packet */
+    u8 chan;        /* Tag set with radio_set_channel() */
+    u32 time;       /* Timer 1 timebase at the sync word */
+    u16 syndrome;   /* CRC left over, for radio_finalize() to repair from */
+} radio_packet;
+
+/*
+ * Transmitter ID masks for radio_set_filter().  The ID is the low three bits
+ * of the first byte of a packet.
+ */
+#define RADIO_ID_BIT(b) (1 << ((b) & 0x07))
+#define RADIO_ALL_IDS   0xFF
+
+/* Modem profiles for radio_set_profile() */
+#define RADIO_ACQUIRE   0   /* Wide filter for an offset not learned yet */
+#define RADIO_TRACK     1   /* Narrower filter once the AFC has locked on */
+#define RADIO_CAPTURE   2   /* Raw bursts into the capture ring, no packets */
+#define RADIO_PROFILES  3
+
+/*
+ * In RADIO_CAPTURE every jump in signal strength starts a burst of this many
+ * raw bytes, with no sync word search.  The ring holds a whole number of
+ * them.  See framesearch.py for making sense of a dump.
+ */
+#define RADIO_CAPTURE_BURST 64
+#define RADIO_CAPTURE_SIZE  1024
+
+/* Packets held between the ISR and the main loop.  Power of two. */
+#define RADIO_RING_SIZE 4
+
 void radio_init(void);
+void radio_set_xtal(u32 ref);
+u32 radio_xtal(void);
+u32 radio_freq_to_word(u32 freq);
+u32 radio_word_to_freq(u32 word);
 u32 setFrequency(u32 freq);
+void setFrequencyWord(u8 freq2, u8 freq1, u8 freq0);
+void setFrequencyCal(u8 freq2, u8 freq1, u8 freq0,
+                     u8 fscal3, u8 fscal2, u8 fscal1);
+void radio_calibrate(u8 freq2, u8 freq1, u8 freq0);
+void radio_set_offset(s8 offset);
+void radio_set_timeout(u32 ticks);
+void radio_set_sniff(u32 ticks);
+void radio_set_channel(u8 chan);
+void radio_set_filter(u8 accept, u8 known);
+void radio_set_profile(u8 p);
+void radio_poll(void);
+void radio_sleep(void);
+void radio_wake(void);
+u8 radio_state(void);
+__xdata radio_packet *radio_peek(void);
+bool radio_finalize(__xdata radio_packet *pkt);
+void radio_release(void);
+u8 radio_queued(void);
+u16 radio_overruns(void);
+u16 radio_crc_errors(void);
+u16 radio_repairs(u8 bits);
+u16 radio_capture_addr(void);
+u16 radio_capture_bursts(void);
+u8 radio_capture_restarts(void);
 
-__data volatile const u8 *radio_getbuf(void);
-
-extern void packet_rx_callback(const __data u8 *buf);
 #endif
@@ -0,0 +1,95 @@
+/*
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2, or (at your option)
+ * any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; see the file COPYING.  If not, write to
+ * the Free Software Foundation, Inc., 51 Franklin Street,
+ * Boston, MA 02110-1301, USA.
+ */
+
+#include <cc1110.h>
+#include "ioCCxx10_bitdef.h"
+#include "timer.h"
+
+/* Upper 16 bits of the timebase, bumped on every Timer 1 overflow */
+static volatile u16 t1_ovf;
+
+/* Time spent in PM2, where Timer 1 stops */
+static u32 t1_slept;
+
+void timer_init(void) {
+    T1CTL = T1CTL_MODE_SUSPEND;
+    CLKCON = (CLKCON & ~CLKCON_TICKSPD) | TICKSPD_DIV_1;
+
+    t1_ovf = 0;
+    t1_slept = 0;
+    T1CNTL = 0;         // Any write clears the whole counter
+    T1CTL = T1CTL_DIV_128 | T1CTL_MODE_FREERUN;
+
+    /*
+     * Channel 0 captures the count on RF interrupts, so packet timestamps
+     * don't depend on how long rf_isr took to get going.  No interrupt of
+     * its own.
+     */
+    T1CCTL0 = T1CCTL0_CPSEL | T1C0_RISE_EDGE;
+
+    T1IF = 0;
+    T1IE = 1;           // Enable Timer 1 interrupt (IEN1.1)
+    EA = 1;
+}
+
+/*
+ * Read the 32 bit timebase.  Safe to call from interrupt context, where an
+ * overflow may be flagged but not serviced yet.  Reentrant because both
+ * rf_isr() and the main loop use it.
+ */
+u32 timer_now(void) __reentrant {
+    u16 hi;
+    u8 lo;
+    u8 mid;
+
+    T1IE = 0;
+    lo = T1CNTL;        /* Reading the low byte latches the high byte */
+    mid = T1CNTH;
+    hi = t1_ovf;
+    if ((T1CTL & T1CTL_OVFIF) && !(mid & 0x80))
+        hi++;
+    T1IE = 1;
+
+    return (((u32)hi << 16) | ((u16)mid << 8) | lo) + t1_slept;
+}
+
+/*
+ * Timebase value at the last channel 0 capture.  Read it within one wrap of
+ * the 16 bit counter, about 300 ms, and before the next RF interrupt.
+ */
+u32 timer_capture(void) {
+    u32 now = timer_now();
+    u16 cap = ((u16)T1CC0H << 8) | T1CC0L;
+
+    /* Counter ticks between the capture and now */
+    u16 since = (u16)(now - t1_slept) - cap;
+
+    return now - since;
+}
+
+/* Account for time Timer 1 was stopped */
+void timer_advance(u32 ticks) {
+    t1_slept += ticks;
+}
+
+/* This is the interrupt vector for T1_VECTOR. */
+void timer1_isr(void) __interrupt (T1_VECTOR)
+{
+    T1CTL &= ~T1CTL_OVFIF;
+    T1IF = 0;
+    t1_ovf++;
+}
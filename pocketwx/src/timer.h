@@ -0,0 +1,44 @@
+/*
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2, or (at your option)
+ * any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; see the file COPYING.  If not, write to
+ * the Free Software Foundation, Inc., 51 Franklin Street,
+ * Boston, MA 02110-1301, USA.
+ */
+
+#ifndef TIMER_H
+#define TIMER_H 1
+
+#include "types.h"
+#include "radio.h"
+
+/*
+ * Timer 1 runs free from the undivided crystal with a prescaler of 128, and
+ * its overflows are counted in software to make a 32 bit timebase.  That is
+ * about 4.7 us per tick on a 27 MHz IM-ME and wraps after about 5.6 hours.
+ * These are for FREQ_REF, so they run 4% slow on the other crystal.  That is
+ * fine for timeouts; anything that needs better works from radio_xtal().
+ */
+#define TIMER_HZ            (FREQ_REF / 128)
+
+/* Convert milliseconds to ticks.  Good for up to about 159 seconds. */
+#define MS_TO_TICKS(ms)     (((u32)(ms) * (FREQ_REF / 1000)) / 128)
+
+void timer_init(void);
+u32 timer_now(void) __reentrant;
+u32 timer_capture(void);
+void timer_advance(u32 ticks);
+
+/* True once the timebase has reached or passed the given tick */
+#define TIMER_EXPIRED(now, deadline)    ((s32)((now) - (deadline)) >= 0)
+
+#endif
@@ -1,3 +1,6 @@
 #define u8 unsigned char
 #define u16 unsigned int
 #define u32 unsigned long int
+#define s8 signed char
+#define s16 signed int
+#define s32 signed long int